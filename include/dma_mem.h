@@ -28,8 +28,21 @@
  * device base / controller struct).
  */
 
+/* Regions / ranges held inline in struct dma_mem_ctx; boards with more Emu68 headers
+ * get heap tables (freed by dma_mem_exit()), up to DMA_MEM_MAX_RANGES. */
 #define DMA_MEM_MAX_REGIONS 8
 
+/* The lookup below stores range indices in a u8. */
+#define DMA_MEM_MAX_RANGES 255
+
+/* DMA engines only see the low 2GB of Pi DRAM; every region lies below this. */
+#define DMA_MEM_2GB 0x80000000UL
+
+/* Reachability lookup: the 2GB window is split into 1MB slots, each holding the
+ * index of the first merged range that ends above the slot base. */
+#define DMA_MEM_LOOKUP_SHIFT 20
+#define DMA_MEM_LOOKUP_SLOTS (DMA_MEM_2GB >> DMA_MEM_LOOKUP_SHIFT)
+
 struct dma_mem_region
 {
 	ULONG start;  /* inclusive */
@@ -37,18 +50,105 @@ struct dma_mem_region
 	APTR  header; /* struct MemHeader * the pool Allocate()s arenas from */
 };
 
+struct dma_mem_range
+{
+	ULONG start; /* inclusive */
+	ULONG end;	 /* exclusive */
+};
+
+/* CPU -> bus translation for one window of the device's bus, from dma-ranges:
+ * bus = cpu + offset for cpu in [cpu_start, cpu_last]. */
+#define DMA_BUS_MAX_RANGES 4
+
+struct dma_bus_range
+{
+	ULONG cpu_start;
+	ULONG cpu_last; /* inclusive, so a window can reach the top of the address space */
+	ULONG offset;	/* bus - cpu, modulo 2^32 */
+};
+
+/* dma_map_addr() result for a buffer no bus window covers. */
+#define DMA_MAP_ERROR ((dma_addr_t)~0UL)
+
 struct dma_mem_ctx
 {
-	u32 count; /* entries in regions[]; each carries its own bounds + header */
+	u32 count; /* entries in the region table; each carries its own bounds + header */
 	struct dma_mem_region regions[DMA_MEM_MAX_REGIONS];
+
+	/* Region bounds sorted by address with touching/overlapping headers merged,
+	 * plus the per-slot index into them; built by dma_mem_init() for the per-I/O
+	 * predicate below. */
+	u32 range_count;
+	struct dma_mem_range ranges[DMA_MEM_MAX_REGIONS];
+	u8 lookup[DMA_MEM_LOOKUP_SLOTS];
+
+	/* Entries the tables hold.  Above DMA_MEM_MAX_REGIONS (a board with more Emu68
+	 * headers) they live in one heap block at @heap instead: @capacity regions,
+	 * then @capacity ranges.  Go through dma_mem_regions() / dma_mem_ranges(). */
+	u32 capacity;
+	APTR heap;
+
+	/* Bus windows for dma_map_addr(): identity after dma_mem_init(), replaced by
+	 * dma_mem_bus_init(). */
+	u32 bus_count;
+	struct dma_bus_range bus[DMA_BUS_MAX_RANGES];
 };
 
+/* The region / merged range tables in use: inline, or the heap block. */
+static inline struct dma_mem_region *dma_mem_regions(struct dma_mem_ctx *ctx)
+{
+	if (ctx->capacity > DMA_MEM_MAX_REGIONS)
+		return (struct dma_mem_region *)ctx->heap;
+	return ctx->regions;
+}
+
+static inline struct dma_mem_range *dma_mem_ranges(struct dma_mem_ctx *ctx)
+{
+	if (ctx->capacity > DMA_MEM_MAX_REGIONS)
+		return (struct dma_mem_range *)((struct dma_mem_region *)ctx->heap + ctx->capacity);
+	return ctx->ranges;
+}
+
 /* Discover the Emu68 RAM regions into @ctx (clears and fills it).  Call once early in
- * driver init, before dma_pool_create()/dma_addr_reachable(). */
+ * driver init, before dma_pool_create()/dma_addr_reachable().  dma_mem_exit() frees
+ * the heap tables of a large board (call it at expunge, and before re-initialising);
+ * a copy of @ctx shares them, so only one of the two may be passed to it. */
 void dma_mem_init(struct dma_mem_ctx *ctx);
+void dma_mem_exit(struct dma_mem_ctx *ctx);
+
+/* Load the CPU -> bus translation of the bus node at @path (the node whose children
+ * master DMA, e.g. the PCIe host bridge) into @ctx.  dma-ranges is read once from
+ * @path and each ancestor and the levels are composed; a missing or empty property
+ * is an identity level.  Windows whose bus side does not fit 32 bits are dropped.
+ * Returns FALSE, leaving the current table in place, if @path does not exist or no
+ * window is usable.  Takes no locks; call at init. */
+BOOL dma_mem_bus_init(struct dma_mem_ctx *ctx, CONST_STRPTR path);
+
+/* Bus address of the CPU buffer [addr, addr+len) for the device, or DMA_MAP_ERROR if
+ * no single window covers it (or @ctx is NULL).  At most DMA_BUS_MAX_RANGES compares.
+ * Apply it to the address given to the hardware, i.e. to dma_map()'s @dma. */
+static inline dma_addr_t dma_map_addr(const struct dma_mem_ctx *ctx, APTR addr, ULONG len)
+{
+	if (ctx == NULL)
+		return DMA_MAP_ERROR;
+
+	ULONG a = (ULONG)addr;
+	ULONG span = len ? len - 1 : 0;
+
+	for (u32 i = 0; i < ctx->bus_count; i++)
+	{
+		const struct dma_bus_range *r = &ctx->bus[i];
+		if (a >= r->cpu_start && a <= r->cpu_last && span <= r->cpu_last - a)
+			return a + r->offset;
+	}
+	return DMA_MAP_ERROR;
+}
 
 /* TRUE iff [addr, addr+len) lies entirely within Emu68 (DMA-reachable) RAM.
  * Returns FALSE if @ctx is NULL or found no regions (fail safe -> caller bounces).
+ *
+ * Constant time: the slot table jumps straight to the candidate range, and the
+ * step-over loop only passes ranges that end inside @addr's own 1MB slot.
  */
 static inline BOOL dma_addr_reachable(struct dma_mem_ctx *ctx, APTR addr, ULONG len)
 {
@@ -66,14 +166,57 @@ static inline BOOL dma_addr_reachable(struct dma_mem_ctx *ctx, APTR addr, ULONG
 	if (ctx->count == 0)
 		return a >= 0x00200000UL;
 
-	for (u32 i = 0; i < ctx->count; i++)
-	{
-		if (a >= ctx->regions[i].start && end <= ctx->regions[i].end)
-			return TRUE;
-	}
-	return FALSE;
+	if (a >= DMA_MEM_2GB)
+		return FALSE;
+
+	const struct dma_mem_range *ranges = dma_mem_ranges(ctx);
+	u32 i = ctx->lookup[a >> DMA_MEM_LOOKUP_SHIFT];
+	while (i < ctx->range_count && ranges[i].end <= a)
+		i++;
+
+	return i < ctx->range_count && a >= ranges[i].start && end <= ranges[i].end;
 }
 
+/* Same, for a device that only drives the address bits in @mask (e.g. 0x3fffffff for
+ * a 30-bit engine): the buffer must also end at or below @mask. */
+static inline BOOL dma_addr_reachable_mask(struct dma_mem_ctx *ctx, APTR addr, ULONG len, ULONG mask)
+{
+	ULONG last = (ULONG)addr + (len ? len - 1 : 0);
+
+	return last >= (ULONG)addr && last <= mask && dma_addr_reachable(ctx, addr, len);
+}
+
+/* One run of a dma_sg_build() split: DMA it in place when @reachable, bounce it
+ * otherwise. */
+struct dma_sg_seg
+{
+	APTR addr;
+	ULONG len;
+	BOOL reachable;
+};
+
+/* Split [addr, addr+len) into alternating reachable / unreachable runs so a driver
+ * can DMA the Emu68 RAM parts directly and bounce only the rest.  Fills up to
+ * @max_segs entries of @segs in address order and returns how many were used (0 for
+ * an empty buffer).  If the buffer has more runs than @max_segs, the last entry
+ * covers the whole remainder and is marked unreachable, so the caller still sees
+ * every byte and fails safe.  Without region info (NULL @ctx or no regions) the
+ * whole buffer is one run, judged by dma_addr_reachable().
+ */
+ULONG dma_sg_build(struct dma_mem_ctx *ctx, APTR addr, ULONG len,
+				   struct dma_sg_seg *segs, ULONG max_segs);
+
+/* --- Arena grab (raw): carve @size bytes aligned to @align straight out of one of
+ *     @ctx's Emu68 headers, with no padding kept (the alignment slack is handed back).
+ *     *@src receives the header for the matching dma_mem_arena_free().  Takes
+ *     Forbid(); meant for pool growth, not the per-I/O path. --- */
+APTR dma_mem_arena_alloc(struct dma_mem_ctx *ctx, ULONG size, ULONG align, APTR *src);
+/* Same, restricted to [@floor, @limit] (inclusive); a header straddling the window has
+ * its free chunks walked for a fit inside it. */
+APTR dma_mem_arena_alloc_window(struct dma_mem_ctx *ctx, ULONG size, ULONG align, ULONG floor,
+								ULONG limit, APTR *src);
+void dma_mem_arena_free(APTR src, APTR arena, ULONG size);
+
 /* Opaque region-pool handle.  Created only by dma_pool_create() */
 struct dma_pool;
 
@@ -82,11 +225,84 @@ struct dma_pool;
 struct dma_pool *dma_pool_create(struct dma_mem_ctx *ctx);
 void dma_pool_delete(struct dma_pool *pool);
 
+/* Same, for a device with a restricted DMA window: every arena is taken from Emu68 RAM
+ * inside [@floor, @limit] (inclusive; pass the device's DMA mask as @limit), so its
+ * buffers are reachable on the first try.  dma_map() on such a pool bounces buffers
+ * outside the window.  Returns NULL if no Emu68 region overlaps the window.
+ * dma_pool_create() is dma_pool_create_limited(ctx, 0, DMA_MEM_LIMIT_NONE). */
+#define DMA_MEM_LIMIT_NONE (~(ULONG)0)
+struct dma_pool *dma_pool_create_limited(struct dma_mem_ctx *ctx, ULONG floor, ULONG limit);
+
+/*
+ * Buddy pool — for large, power-of-two DMA buffers (descriptor rings, xHCI
+ * scratchpads, frame buffers).  Blocks of 4 KB .. 1 MB are carved from naturally
+ * aligned 1 MB superblocks of Emu68 RAM, so a block is always aligned to its own
+ * size with no padding and no hidden header.  Requests are rounded up to the next
+ * power of two; alloc/free are O(log n) in the number of block orders, and freed
+ * buddies coalesce.  The caller passes the allocation size back to
+ * dma_buddy_free().  A fully free superblock beyond one spare is returned to Emu68
+ * RAM.  Not locked, like struct dma_pool.
+ */
+#define DMA_BUDDY_MIN_SHIFT 12 /* 4 KB */
+#define DMA_BUDDY_MAX_SHIFT 20 /* 1 MB superblock */
+
+struct dma_buddy;
+
+struct dma_buddy *dma_buddy_create(struct dma_mem_ctx *ctx);
+void dma_buddy_delete(struct dma_buddy *buddy);
+APTR dma_buddy_alloc(struct dma_buddy *buddy, ULONG size);
+void dma_buddy_free(struct dma_buddy *buddy, APTR ptr, ULONG size);
+
+/* Puddle reclaim.  A puddle whose blocks are all freed is returned to Emu68 RAM as
+ * soon as the pool holds more than @spare empty puddles (default 1), so a traffic
+ * burst does not pin its arenas until expunge while a steady load does not flap
+ * between grow and release.  Blocks parked in the size-class caches do not count:
+ * a puddle holding nothing else gets them back and is released all the same.
+ * dma_pool_set_spare() applies the new limit at once; dma_pool_trim() additionally
+ * flushes every size-class cache back to its puddles (e.g. under memory pressure). */
+void dma_pool_set_spare(struct dma_pool *pool, ULONG spare);
+void dma_pool_trim(struct dma_pool *pool);
+
+/* Up-front reservation.  Growing a pool Forbid()s and walks every Emu68 header, which
+ * must not happen in the middle of an I/O.  dma_pool_reserve() grabs arenas now (call
+ * it from init/open) until at least @bytes are free in the pool, and from then on
+ * the allocation path never grows: a request that does not fit returns NULL.
+ * Instead, once the free headroom drops below @low_water (0 = @bytes / 4),
+ * dma_pool_refill_pending() turns TRUE and the driver calls dma_pool_refill() from a
+ * low-priority context (its task loop, a timer, ...) to top the headroom back up to
+ * @bytes.  Reserved headroom is never released by puddle reclaim, and on a
+ * reserved pool the free path releases nothing either (that would Forbid() too):
+ * surplus empty puddles wait for the next dma_pool_refill() or dma_pool_trim(), and
+ * dma_pool_refill_pending() turns TRUE for them as well.  @bytes == 0
+ * removes the reservation and restores on-demand growth.  dma_pool_reserve()
+ * returns FALSE if Emu68 RAM could not cover @bytes (what it got is kept);
+ * dma_pool_refill() returns the bytes it added. */
+BOOL dma_pool_reserve(struct dma_pool *pool, ULONG bytes, ULONG low_water);
+BOOL dma_pool_refill_pending(struct dma_pool *pool);
+ULONG dma_pool_refill(struct dma_pool *pool);
+
+/* Allocation statistics (EMU68_MEM_STATS build option -> MEM_STATS): counts,
+ * bytes in use and high-water mark, a request-size histogram and per-puddle
+ * occupancy / largest free chunk, printed through Kprintf.  Compiled out otherwise. */
+#ifdef MEM_STATS
+void dma_pool_stats_dump(struct dma_pool *pool, CONST_STRPTR name);
+#else
+#define dma_pool_stats_dump(pool, name) ((void)0)
+#endif
+
 /* --- Region sub-allocator (raw); prefer the dma_alloc/dma_zalloc/dma_free helpers
- *     below, which add the cache-line alignment + size bookkeeping. --- */
+ *     below, which add the cache-line alignment + size bookkeeping.  A size of
+ *     exactly a power of two from 64 B to 16 KB is a size-class block, aligned to
+ *     its own size. --- */
 APTR dma_pool_region_alloc(struct dma_pool *pool, ULONG size);
 void dma_pool_region_free(struct dma_pool *pool, APTR ptr, ULONG size);
 
+/* Same, but hand out / take back the opaque owning-puddle handle so the free needs
+ * no search of the pool's puddle list.  @owner must be the value the matching
+ * _owned alloc returned (or NULL if unknown, which falls back to the search). */
+APTR dma_pool_region_alloc_owned(struct dma_pool *pool, ULONG size, APTR *owner);
+void dma_pool_region_free_owned(struct dma_pool *pool, APTR ptr, ULONG size, APTR owner);
+
 /*
  * dma_alloc/dma_zalloc/dma_free — DMA-buffer allocation from a region pool.
  *
@@ -95,37 +311,82 @@ void dma_pool_region_free(struct dma_pool *pool, APTR ptr, ULONG size);
  * so the buffer owns whole cache lines at BOTH ends (a partial trailing line shared
  * with the next allocation would be discarded by the post-DMA invalidate — see the
  * 68040.library CachePreDMA/PostDMA contract).
+ *
+ * Buffers of up to DMA_ALLOC_CLASS_MAX bytes are size-class blocks: the payload is
+ * rounded up to a power of two (at least DMA_ALLOC_CLASS_MIN), and the block is
+ * aligned to its own size, so it needs no alignment slack and no header.
+ * dma_free() finds its class and owning puddle from the address alone.  The
+ * rounding costs up to half a block for odd payloads; dma_alloc_oob() keeps such
+ * buffers (e.g. 1536-byte RX rings) at their exact size.
+ *
+ * Larger buffers (or an @align above DMA_ALLOC_CLASS_MAX) carry a hidden header at
+ * the start of the raw block that records its size and owning puddle, so
+ * dma_free() is constant-time however many puddles the pool has grown.
  */
-static inline void *dma_alloc(struct dma_pool *pool, ULONG align, ULONG size)
+#define DMA_ALLOC_CLASS_MIN 64UL
+#define DMA_ALLOC_CLASS_MAX 16384UL
+
+struct dma_alloc_hdr
 {
-	if (align < sizeof(APTR))
-		align = sizeof(APTR);
+	ULONG total; /* raw block size passed to the region allocator */
+	APTR owner;	 /* owning puddle (dma_pool_region_alloc_owned) */
+};
 
+/* Class block size for a dma_alloc of @size at @align, or 0 for a header block. */
+static inline ULONG dma_alloc_class(ULONG align, ULONG size)
+{
 	if (align >= DMA_ALIGN_MIN)
 		size = (size + (align - 1)) & ~(align - 1);
+	if (size > DMA_ALLOC_CLASS_MAX || align > DMA_ALLOC_CLASS_MAX)
+		return 0;
+
+	ULONG cls = DMA_ALLOC_CLASS_MIN;
+	if (size > DMA_ALLOC_CLASS_MIN)
+		cls = 1UL << (32 - __builtin_clz((unsigned int)(size - 1)));
+	return cls < align ? align : cls;
+}
 
-	ULONG total = size + (align - 1) + sizeof(APTR) + sizeof(ULONG);
-	APTR raw = dma_pool_region_alloc(pool, total);
+/* Raw block size for a header dma_alloc of @size at *@align (normalised in place). */
+static inline ULONG dma_alloc_total(ULONG *align, ULONG size)
+{
+	if (*align < sizeof(APTR))
+		*align = sizeof(APTR);
+
+	if (*align >= DMA_ALIGN_MIN)
+		size = (size + (*align - 1)) & ~(*align - 1);
+
+	return size + (*align - 1) + sizeof(APTR) + sizeof(struct dma_alloc_hdr);
+}
+
+/* Fill in the hidden header of raw block @raw and return the aligned buffer. */
+static inline void *dma_alloc_finish(struct dma_alloc_hdr *raw, ULONG total, ULONG align, APTR owner)
+{
 	if (!raw)
 		return NULL;
 
-	APTR aligned = (APTR)(((ULONG)raw + sizeof(ULONG) + sizeof(APTR) + align - 1) & ~(align - 1));
+	APTR aligned = (APTR)(((ULONG)raw + sizeof(struct dma_alloc_hdr) + sizeof(APTR) + align - 1) & ~(align - 1));
 	((APTR *)aligned)[-1] = raw;
-	*(ULONG *)raw = total;
+	raw->total = total;
+	raw->owner = owner;
 
 	return aligned;
 }
 
-static inline void dma_free(struct dma_pool *pool, void *ptr)
+static inline void *dma_alloc(struct dma_pool *pool, ULONG align, ULONG size)
 {
-	if (ptr)
-	{
-		APTR raw = ((APTR *)ptr)[-1];
-		ULONG size = *(ULONG *)raw;
-		dma_pool_region_free(pool, raw, size);
-	}
+	ULONG cls = dma_alloc_class(align, size);
+	if (cls)
+		return dma_pool_region_alloc(pool, cls);
+
+	ULONG total = dma_alloc_total(&align, size);
+	APTR owner = NULL;
+	struct dma_alloc_hdr *raw = dma_pool_region_alloc_owned(pool, total, &owner);
+
+	return dma_alloc_finish(raw, total, align, owner);
 }
 
+void dma_free(struct dma_pool *pool, void *ptr);
+
 static inline void *dma_zalloc(struct dma_pool *pool, ULONG align, ULONG size)
 {
 	void *ptr = dma_alloc(pool, align, size);
@@ -134,4 +395,167 @@ static inline void *dma_zalloc(struct dma_pool *pool, ULONG align, ULONG size)
 	return ptr;
 }
 
+/*
+ * dma_alloc_oob/dma_zalloc_oob/dma_free_oob — the same, with the bookkeeping out of
+ * band.  The block is exactly @size bytes (rounded up to @align when that is a cache
+ * line or coarser) at an @align-aligned address, with no hidden header and no
+ * alignment slack: the size and owning puddle live in a per-pool hash keyed by
+ * address.  Pays off for many line-aligned buffers (RX rings), where dma_alloc()'s
+ * header costs an extra cache line each.  Pair only with dma_free_oob().  The hash
+ * grows with AllocMem() as the count doubles; reserve-mode pools never grow arenas
+ * here, as with dma_alloc().
+ */
+void *dma_alloc_oob(struct dma_pool *pool, ULONG align, ULONG size);
+void dma_free_oob(struct dma_pool *pool, void *ptr);
+
+static inline void *dma_zalloc_oob(struct dma_pool *pool, ULONG align, ULONG size)
+{
+	void *ptr = dma_alloc_oob(pool, align, size);
+	if (ptr)
+		memset(ptr, 0, size);
+	return ptr;
+}
+
+/*
+ * Concurrent mode — one pool shared by several tasks (unit tasks, BeginIO callers).
+ *
+ * dma_pool_enable_concurrent() (once, before the pool is shared) puts a
+ * SignalSemaphore around every pool operation.  On top of that each task can own a
+ * struct dma_pool_cache (embed it in the unit / per-opener struct): a small magazine
+ * of recently freed size-class blocks per class (64 B .. 16 KB), so a
+ * dma_cache_alloc / dma_cache_free pair of a buffer dma_alloc() would serve as a
+ * class block takes no lock at all: dma_cache_free() finds the class from the
+ * address without one.  Larger buffers go to the locked pool.  An empty magazine is
+ * refilled with half a magazine from the pool's class caches (the shared depot)
+ * under one lock; a full one returns its older half the same way.  Blocks freed to
+ * a cache may come from any cache or from dma_alloc() on the same pool.  Call
+ * dma_pool_cache_flush() before the owning task goes away.  With MEM_STATS, a
+ * magazine block counts as allocated only while a caller holds it: each cache
+ * tallies its lock-free hand-outs and returns and folds them into the pool's
+ * statistics whenever it takes the lock.  Semaphores make this task-context only:
+ * interrupt code must not allocate (use preallocated bounce slots / rings
+ * instead).
+ */
+#define DMA_POOL_CACHE_CLASSES 9 /* the pool's size classes, 64 B .. 16 KB */
+#define DMA_POOL_MAG_SIZE 8
+
+struct dma_pool_cache
+{
+	struct dma_pool *pool;
+	ULONG count[DMA_POOL_CACHE_CLASSES];
+	APTR mag[DMA_POOL_CACHE_CLASSES][DMA_POOL_MAG_SIZE];
+#ifdef MEM_STATS
+	ULONG allocs[DMA_POOL_CACHE_CLASSES]; /* hand-outs not yet folded into the pool's stats */
+	ULONG frees[DMA_POOL_CACHE_CLASSES];  /* returns, likewise */
+#endif
+};
+
+void dma_pool_enable_concurrent(struct dma_pool *pool);
+void dma_pool_cache_init(struct dma_pool_cache *cache, struct dma_pool *pool);
+void dma_pool_cache_flush(struct dma_pool_cache *cache);
+APTR dma_pool_cache_region_alloc(struct dma_pool_cache *cache, ULONG size, APTR *owner);
+void dma_pool_cache_region_free(struct dma_pool_cache *cache, APTR ptr, ULONG size, APTR owner);
+
+static inline void *dma_cache_alloc(struct dma_pool_cache *cache, ULONG align, ULONG size)
+{
+	ULONG cls = dma_alloc_class(align, size);
+	APTR owner = NULL;
+	if (cls)
+		return dma_pool_cache_region_alloc(cache, cls, &owner);
+
+	ULONG total = dma_alloc_total(&align, size);
+	struct dma_alloc_hdr *raw = dma_pool_cache_region_alloc(cache, total, &owner);
+
+	return dma_alloc_finish(raw, total, align, owner);
+}
+
+void dma_cache_free(struct dma_pool_cache *cache, void *ptr);
+
+/*
+ * Bounce engine — a fixed set of cache-line-aligned bounce slots per pool.
+ *
+ * dma_pool_bounce_init() carves @slot_count slots of @slot_size bytes out of the
+ * pool once, at driver init.  dma_map() then hands the device either the caller's
+ * buffer itself (zero-copy, when it is DMA-reachable and — for transfers the device
+ * writes — owns whole cache lines) or a free slot, copying the data in for
+ * DMA_TO_DEVICE; dma_unmap() copies back for DMA_FROM_DEVICE and releases the slot.
+ * The per-I/O path never allocates and never Forbid()s.  The slot list is guarded
+ * like the rest of the pool: by the pool semaphore in concurrent mode, otherwise
+ * not at all (one pool, one context, or the caller serialises).
+ *
+ * Only data movement is done here; cache maintenance around the transfer stays with
+ * the caller (CachePreDMA/CachePostDMA on map->dma).
+ */
+#define DMA_TO_DEVICE 1	  /* device reads the buffer */
+#define DMA_FROM_DEVICE 2 /* device writes the buffer */
+#define DMA_BIDIRECTIONAL (DMA_TO_DEVICE | DMA_FROM_DEVICE)
+
+struct dma_map
+{
+	APTR buf;	/* caller's buffer */
+	APTR dma;	/* what to give the device: @buf itself or a bounce slot */
+	ULONG len;
+	ULONG dir;	/* DMA_TO_DEVICE / DMA_FROM_DEVICE / DMA_BIDIRECTIONAL */
+	APTR slot;	/* bounce slot in use; NULL when mapped in place */
+};
+
+/* Preallocate the pool's bounce slots (once per pool).  @slot_size is rounded up to
+ * DMA_ALIGN_MIN.  Returns FALSE on a repeat call or when the pool is exhausted. */
+BOOL dma_pool_bounce_init(struct dma_pool *pool, ULONG slot_count, ULONG slot_size);
+
+/* Map @buf for a @dir transfer into @map.  Returns FALSE only when a bounce is
+ * needed but impossible (no slots configured, all in use, or @len larger than a
+ * slot); the caller then falls back or retries after a dma_unmap(). */
+BOOL dma_map(struct dma_pool *pool, struct dma_map *map, APTR buf, ULONG len, ULONG dir);
+void dma_unmap(struct dma_pool *pool, struct dma_map *map);
+
+/*
+ * Cache maintenance around a transfer (the CachePreDMA/CachePostDMA contract).
+ *
+ * dma_sync_for_device() hands a buffer to the device (CachePreDMA: dirty lines are
+ * written back, with DMA_ReadFromRAM when the device reads it); dma_sync_for_cpu()
+ * takes it back after the transfer (CachePostDMA: lines the device wrote are
+ * invalidated).  @dir is the DMA_TO_DEVICE / DMA_FROM_DEVICE / DMA_BIDIRECTIONAL of
+ * the transfer; for_cpu of a pure DMA_TO_DEVICE buffer has nothing to invalidate and
+ * issues no cache call.
+ *
+ * The _batch variants take many buffers at once (e.g. a whole RX ring refill): the
+ * ranges are widened to whole DMA_ALIGN_MIN lines, sorted, and adjacent or
+ * overlapping ones merged, so one cache call covers each contiguous span.  They
+ * coalesce @ranges in place (the array is reordered and shortened, with the
+ * entries past the spans emptied), so the same array and count can go straight to
+ * the matching _batch call after the transfer.  dma_sync_coalesce() is that step
+ * on its own and returns the span count.
+ *
+ * Ownership tracker (EMU68_DMA_TRACK build option -> DMA_TRACK; debug builds only).
+ * Each pool records the buffers the device currently owns (@pool is the pool whose
+ * table is used; NULL skips tracking, e.g. for persistent descriptor rings).
+ * dma_map() hands a buffer over until dma_unmap(); dma_sync_for_device*() and
+ * dma_sync_for_cpu*() on (part of) a mapped buffer pass ownership back and forth
+ * without a report, and on anything else hand it over and take it back.
+ * Reported through Kprintf: a hand-over of a buffer overlapping one the device
+ * already owns (double map), a take-back of something not handed over, a free of a
+ * pool block still mapped or device-owned, a buffer sharing a cache line with
+ * another handed-over one when either is device-written (named in the report), a
+ * device-written buffer synced for the device that does not start and end on a
+ * cache line (the invalidate afterwards also drops whatever else is in those lines;
+ * untracked neighbours cannot be told from slack, so this is reported for every
+ * partial line), and CPU writes to a DMA_TO_DEVICE buffer while the device owned
+ * it (checksum compare).  Compiled out otherwise.
+ */
+struct dma_sync_range
+{
+	APTR addr;
+	ULONG len;
+};
+
+ULONG dma_sync_coalesce(struct dma_sync_range *ranges, ULONG count);
+
+void dma_sync_for_device(struct dma_pool *pool, APTR addr, ULONG len, ULONG dir);
+void dma_sync_for_cpu(struct dma_pool *pool, APTR addr, ULONG len, ULONG dir);
+void dma_sync_for_device_batch(struct dma_pool *pool, struct dma_sync_range *ranges, ULONG count,
+							   ULONG dir);
+void dma_sync_for_cpu_batch(struct dma_pool *pool, struct dma_sync_range *ranges, ULONG count,
+							ULONG dir);
+
 #endif /* _DMA_MEM_H */
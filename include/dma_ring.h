@@ -0,0 +1,109 @@
+// SPDX-License-Identifier: MPL-2.0 OR GPL-2.0+
+#ifndef _DMA_RING_H
+#define _DMA_RING_H
+
+#include <types.h>
+#include <byteorder.h>
+#include <dma_mem.h>
+
+/*
+ * Producer/consumer descriptor ring in Emu68 (DMA-reachable) RAM.
+ *
+ * The ring owns a power-of-two array of fixed-size descriptors carved from a
+ * struct dma_pool.  Indices are free-running ULONGs (head - tail is the number in
+ * flight, wrap is a mask), so a driver never special-cases the end of the array:
+ *
+ *   - dma_ring_produce() / DMA_RING_SLOT() hand out the next descriptor to fill
+ *     (fields in the device's byte order, i.e. le32()/le16() as before);
+ *   - dma_ring_publish() makes everything produced since the last publish visible to
+ *     the device with one cache flush of just that span, and returns the new head
+ *     index to write to the doorbell / tail register;
+ *   - dma_ring_reclaim() takes the device's consumer index, invalidates the span it
+ *     has completed so its status writeback is visible, and returns how many
+ *     descriptors came back (read them from the old dma_ring_tail() onwards).
+ *
+ * Cache maintenance is done in whole DMA_ALIGN_MIN lines.  Descriptors smaller than
+ * a line share lines with their neighbours, so reclaim before producing in the same
+ * pass (the usual "reap completions, then refill" order): a line the CPU has dirtied
+ * but not yet published must not be invalidated under it.  Not locked; one ring,
+ * one context.
+ */
+
+struct dma_ring
+{
+	UBYTE *desc;	 /* descriptor array (CPU address), DMA_ALIGN_MIN aligned */
+	ULONG elem_size; /* bytes per descriptor (the hardware stride) */
+	ULONG count;	 /* descriptors, power of two */
+	ULONG mask;		 /* count - 1 */
+	ULONG head;		 /* next descriptor to produce (free-running) */
+	ULONG published; /* head at the last dma_ring_publish() */
+	ULONG tail;		 /* oldest descriptor not yet reclaimed (free-running) */
+	struct dma_pool *pool;
+};
+
+/* Allocate a zeroed ring of @count (power of two) descriptors of @elem_size bytes,
+ * aligned to @align (at least DMA_ALIGN_MIN), from @pool and flush it so the device
+ * starts from the zeroed state.  Returns FALSE on bad arguments or no memory. */
+BOOL dma_ring_init(struct dma_ring *ring, struct dma_pool *pool, ULONG elem_size, ULONG count,
+				   ULONG align);
+void dma_ring_free(struct dma_ring *ring);
+
+/* Same with the element size taken from the descriptor type at compile time. */
+#define DMA_RING_INIT(ring, pool, type, count, align) \
+	dma_ring_init((ring), (pool), sizeof(type), (count), (align))
+
+/* Descriptor at free-running index @idx, typed.  @type must be the ring's
+ * descriptor type (its sizeof is the stride). */
+#define DMA_RING_SLOT(ring, type, idx) (&((type *)(ring)->desc)[(idx) & (ring)->mask])
+
+/* Descriptors free for the producer / in flight (produced, not yet reclaimed).  One
+ * slot always stays empty, so a device index equal to the tail means "nothing done"
+ * rather than "everything done". */
+static inline ULONG dma_ring_space(const struct dma_ring *ring)
+{
+	return ring->mask - (ring->head - ring->tail);
+}
+
+static inline ULONG dma_ring_pending(const struct dma_ring *ring)
+{
+	return ring->head - ring->tail;
+}
+
+static inline ULONG dma_ring_head(const struct dma_ring *ring)
+{
+	return ring->head;
+}
+
+static inline ULONG dma_ring_tail(const struct dma_ring *ring)
+{
+	return ring->tail;
+}
+
+/* Array position of a free-running index, for the device's head/tail registers. */
+static inline ULONG dma_ring_index(const struct dma_ring *ring, ULONG idx)
+{
+	return idx & ring->mask;
+}
+
+/* Claim the next descriptor for filling, or NULL when the ring is full (count - 1
+ * in flight).  It reaches the device at the next dma_ring_publish(). */
+static inline APTR dma_ring_produce(struct dma_ring *ring)
+{
+	if (unlikely(ring->head - ring->tail == ring->mask))
+		return NULL;
+
+	return ring->desc + (ring->head++ & ring->mask) * ring->elem_size;
+}
+
+/* Flush the descriptors produced since the last publish (none is a no-op) and
+ * return the new head index, free-running; pass it through dma_ring_index() for the
+ * device's doorbell. */
+ULONG dma_ring_publish(struct dma_ring *ring);
+
+/* Reclaim up to the device's consumer index @hw_idx (an array position; only the low
+ * bits below count are used).  Invalidates the completed span and advances the tail;
+ * returns the number of descriptors reclaimed (0 if none).  Never reclaims past what
+ * was published. */
+ULONG dma_ring_reclaim(struct dma_ring *ring, ULONG hw_idx);
+
+#endif /* _DMA_RING_H */
@@ -0,0 +1,79 @@
+// SPDX-License-Identifier: MPL-2.0 OR GPL-2.0+
+#ifndef _KMALLOC_H
+#define _KMALLOC_H
+
+#include <types.h>
+#include <slab.h>
+
+/*
+ * General-purpose small allocations over slab caches: power-of-two and 3/4 size
+ * classes (16, 24, 32, 48, ... 3072, 4096 B), one struct slab_cache per class.
+ * Allocation and free are a class lookup plus slab_alloc()/slab_free(), so the hot
+ * path never enters Exec and objects carry no size header: kfree() takes the size
+ * that was passed to kmalloc().
+ *
+ * A heap is CPU or DMA like a slab cache: @dma_pool == NULL takes data from
+ * @meta_pool, a non-NULL @dma_pool makes every object DMA-reachable and cache-line
+ * aligned.  In a DMA heap the classes below one line share the DMA_ALIGN_MIN cache
+ * (and 96 B shares 128 B).  Not locked; one heap per context, or serialise.
+ */
+
+#define KMALLOC_MIN     16UL
+#define KMALLOC_MAX     4096UL
+#define KMALLOC_CLASSES 17
+
+struct kmalloc_heap {
+	struct slab_cache *cache[KMALLOC_CLASSES]; /* per class; aliases share one cache */
+	struct slab_cache  caches[KMALLOC_CLASSES];
+};
+
+void  kmalloc_init(struct kmalloc_heap *heap, APTR meta_pool, struct dma_pool *dma_pool);
+void  kmalloc_destroy(struct kmalloc_heap *heap);
+
+/* Release fully free slabs of every class (see slab_shrink()); returns the count. */
+ULONG kmalloc_shrink(struct kmalloc_heap *heap);
+
+#ifdef MEM_STATS
+void kmalloc_stats_dump(struct kmalloc_heap *heap, CONST_STRPTR name);
+#else
+#define kmalloc_stats_dump(heap, name) ((void)0)
+#endif
+
+/* Class of a request of @size (1..KMALLOC_MAX) bytes: even classes are 16 << j, odd
+ * ones 24 << j. */
+static inline ULONG kmalloc_index(ULONG size)
+{
+	if (size <= KMALLOC_MIN)
+		return 0;
+
+	ULONG top = 31 - (ULONG)__builtin_clz((unsigned int)(size - 1)); /* size in (2^top, 2^(top+1)] */
+	ULONG j = top - 4;
+
+	return size <= (3UL << (top - 1)) ? 2 * j + 1 : 2 * j + 2;
+}
+
+/* NULL for 0 bytes, more than KMALLOC_MAX, or no memory. */
+static inline void *kmalloc(struct kmalloc_heap *heap, ULONG size)
+{
+	if (unlikely(size - 1 >= KMALLOC_MAX))
+		return NULL;
+
+	return slab_alloc(heap->cache[kmalloc_index(size)]);
+}
+
+static inline void *kzalloc(struct kmalloc_heap *heap, ULONG size)
+{
+	void *ptr = kmalloc(heap, size);
+	if (ptr)
+		memset(ptr, 0, size);
+	return ptr;
+}
+
+/* @size must be what was passed to kmalloc(); NULL is ignored. */
+static inline void kfree(struct kmalloc_heap *heap, void *ptr, ULONG size)
+{
+	if (ptr)
+		slab_free(heap->cache[kmalloc_index(size)], ptr);
+}
+
+#endif
@@ -7,45 +7,247 @@
 
 struct slab_node {
 	struct slab_node *next;
-	void             *data;
+	void             *data; /* allocation, as returned by meta_pool / dma_pool */
+	char             *objs; /* first object: data + this slab's colour offset */
+	ULONG             free; /* free objects in this slab; counted by slab_shrink() */
+	void            **links; /* side free-list links, one per object; NULL unless SLAB_LINK_SIDE */
 };
 
+/* The cache's slabs sorted by address; private to slab.c. */
+struct slab_index;
+
+#ifdef MEM_STATS
+struct slab_stats {
+	ULONG allocs;
+	ULONG frees;
+	ULONG in_use;
+	ULONG high_water;
+	ULONG slabs;
+};
+#endif
+
+/* Object constructor / destructor (Bonwick-style object caching).  The constructor
+ * runs once, the first time an object is handed out, and may fail (e.g. no memory
+ * for a DMA sub-buffer); the object then stays unconstructed and the allocation
+ * returns NULL.  Freed objects keep their constructed state, so a cache with a
+ * constructor hands them back as the caller left them: restore any fields it
+ * relies on before slab_free().  The destructor runs on each constructed object
+ * when its slab is released (slab_shrink(), slab_cache_destroy()). */
+typedef BOOL (*slab_ctor_t)(APTR obj, APTR user);
+typedef void (*slab_dtor_t)(APTR obj, APTR user);
+
 struct slab_cache {
-	void             *free_list;
+	void             *free_list; /* recycled objects */
+	void   *volatile  irq_pending; /* objects freed by slab_free_irq(), not yet taken over */
+	void             *clean_list; /* free objects known zero apart from their link (slab_scrub()) */
+	char             *bump;      /* untouched objects of the newest slab: [bump, bump_end) */
+	char             *bump_end;
+	BOOL              bump_clean; /* the bump region was zero-filled at slab_grow() */
+	BOOL              prezero;   /* zero-fill new slabs (slab_cache_set_prezero()) */
 	APTR              meta_pool; /* Exec pool: slab nodes (+ data when dma_pool == NULL) */
 	struct dma_pool  *dma_pool;  /* region pool: DMA data; NULL => CPU-only slab */
 	struct slab_node *slabs;
+	struct slab_index *index;    /* @slabs by address, for slab_owner() */
 	ULONG             obj_size;
 	ULONG             obj_align;
 	ULONG             slab_capacity;
+	ULONG             link_off;  /* free-list link offset: 0, in the padding, or SLAB_LINK_SIDE */
+	ULONG             colour_step; /* colour granularity; 0 => colouring off */
+	ULONG             colour_span; /* extra bytes per slab the colour rotates through */
+	ULONG             colour_next; /* offset for the next slab */
+	slab_ctor_t       ctor;
+	slab_dtor_t       dtor;
+	APTR              ctor_user;
+#ifdef MEM_STATS
+	struct slab_stats stats;
+#endif
 };
 
 /* @dma_pool == NULL makes a CPU-only slab (data from @meta_pool); a non-NULL
  * @dma_pool makes the data DMA-reachable (Emu68 RAM). */
 void  slab_cache_init(struct slab_cache *cache, APTR meta_pool, struct dma_pool *dma_pool,
                       ULONG obj_size, ULONG obj_align, ULONG slab_capacity);
+/* Same with object caching: @ctor / @dtor (either may be NULL) get @user.  With a
+ * constructor a free object keeps all @obj_size bytes intact: the free-list link
+ * goes in the alignment padding after the object when there is a spare word.
+ * Otherwise a pointer-aligned object grows by one word for it, and a more strictly
+ * aligned one (any DMA cache) keeps its size and gets its link from a per-slab side
+ * array (Bonwick's bufctls), so a 64-byte DMA object still takes 64 bytes.  Finding
+ * a side link is a binary search over the cache's slabs instead of an add. */
+void  slab_cache_init_ctor(struct slab_cache *cache, APTR meta_pool, struct dma_pool *dma_pool,
+                           ULONG obj_size, ULONG obj_align, ULONG slab_capacity,
+                           slab_ctor_t ctor, slab_dtor_t dtor, APTR user);
 void  slab_cache_destroy(struct slab_cache *cache);
+
+/* Known-zero objects, so slab_zalloc() can skip its memset.  With @prezero set,
+ * slab_grow() zero-fills each new slab once and its untouched bump region is handed
+ * to slab_zalloc() as is (growth then costs one fill of the slab).  slab_scrub()
+ * zeroes up to @max recycled objects from an idle path and keeps them on a clean
+ * list that slab_zalloc() prefers; it returns how many it cleaned.  Both are no-ops
+ * on a cache with a constructor. */
+void  slab_cache_set_prezero(struct slab_cache *cache, BOOL prezero);
+ULONG slab_scrub(struct slab_cache *cache, ULONG max);
+/* Add a slab and return its first object; the rest become the bump region, handed
+ * out untouched, so growing costs the same whatever the slab size.  Only called
+ * once the free list and the bump region are both empty. */
 void *slab_grow(struct slab_cache *cache);
 
+/* Take the slab_free_irq() objects over onto the free list (one atomic swap plus a
+ * splice) and return the new free-list head.  Called by the allocation paths when
+ * the free list runs dry, and by slab_shrink(). */
+void *slab_take_irq(struct slab_cache *cache);
+
+/* Give every slab whose objects are all free back to meta_pool / dma_pool and
+ * return how many were released.  Occupancy is counted here, by walking the free
+ * list, so slab_alloc()/slab_free() stay O(1): each free object is found in the
+ * cache's address-sorted slab index (kept by slab_grow()), so a pass is
+ * O(objects log slabs + slabs).  Call it from a maintenance path (after a burst,
+ * under memory pressure), not per I/O.  Same locking as the rest of the cache:
+ * none, the caller serialises. */
+ULONG slab_shrink(struct slab_cache *cache);
+
+/* Allocation statistics (EMU68_MEM_STATS build option -> MEM_STATS): alloc/free
+ * counts, objects in use and high-water mark, slab count and fill, dumped through
+ * Kprintf.  Compiled out otherwise. */
+#ifdef MEM_STATS
+void slab_cache_stats_dump(struct slab_cache *cache, CONST_STRPTR name);
+
+static inline void slab_stat_alloc(struct slab_cache *cache)
+{
+	cache->stats.allocs++;
+	if (++cache->stats.in_use > cache->stats.high_water)
+		cache->stats.high_water = cache->stats.in_use;
+}
+
+static inline void slab_stat_free(struct slab_cache *cache)
+{
+	cache->stats.frees++;
+	cache->stats.in_use--;
+}
+#else
+#define slab_cache_stats_dump(cache, name) ((void)0)
+#define slab_stat_alloc(cache) ((void)0)
+#define slab_stat_free(cache) ((void)0)
+#endif
+
+/* link_off of a constructor cache with no spare padding word and an alignment
+ * above a pointer: the links live in each slab's side array. */
+#define SLAB_LINK_SIDE (~0UL)
+
+void **slab_side_link(const struct slab_cache *cache, void *obj);
+
+/* Free-list link of @obj. */
+static inline void **slab_link(const struct slab_cache *cache, void *obj)
+{
+	if (unlikely(cache->link_off == SLAB_LINK_SIDE))
+		return slab_side_link(cache, obj);
+	return (void **)((char *)obj + cache->link_off);
+}
+
+/* 68020+ CAS on a pointer: store @new if *@ptr still holds @old.  Returns what
+ * *@ptr held, so the store happened iff that equals @old.  Host builds (tests/) use
+ * the compiler builtin instead. */
+static inline void *slab_cas(void *volatile *ptr, void *old, void *new)
+{
+#ifdef __m68k__
+	asm volatile("cas.l %[cmp], %[upd], %[mem]"
+	             : [cmp] "+d"(old), [mem] "+m"(*ptr)
+	             : [upd] "d"(new)
+	             : "cc", "memory");
+#else
+	__atomic_compare_exchange_n(ptr, &old, new, FALSE, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+#endif
+	return old;
+}
+
 static inline void *slab_alloc(struct slab_cache *cache)
 {
 	void *ptr = cache->free_list;
+	if (unlikely(!ptr) && cache->irq_pending)
+		ptr = slab_take_irq(cache);
 	if (likely(ptr)) {
-		cache->free_list = *(void **)ptr;
-		return ptr;
+		cache->free_list = *slab_link(cache, ptr);
+	} else if (cache->clean_list) {
+		ptr = cache->clean_list;
+		cache->clean_list = *slab_link(cache, ptr);
+	} else if (likely(cache->bump != cache->bump_end)) {
+		ptr = cache->bump;
+		if (cache->ctor && !cache->ctor(ptr, cache->ctor_user))
+			return NULL;
+		cache->bump += cache->obj_size;
+	} else {
+		ptr = slab_grow(cache);
+		if (!ptr)
+			return NULL;
 	}
-	return slab_grow(cache);
+	slab_stat_alloc(cache);
+	return ptr;
 }
 
 static inline void slab_free(struct slab_cache *cache, void *ptr)
 {
-	*(void **)ptr = cache->free_list;
+	*slab_link(cache, ptr) = cache->free_list;
 	cache->free_list = ptr;
+	slab_stat_free(cache);
 }
 
+/* Free from an interrupt server (or any context that may interrupt the task-side
+ * calls) without Disable(): a CAS push onto a separate pending list, which the task
+ * side takes over whole, so there is no ABA window.  Needs a 68020+ (CAS).  The
+ * object becomes reusable once the task side next runs dry; MEM_STATS counts it
+ * then. */
+static inline void slab_free_irq(struct slab_cache *cache, void *ptr)
+{
+	void *head = cache->irq_pending;
+
+	for (;;) {
+		*slab_link(cache, ptr) = head;
+		void *seen = slab_cas(&cache->irq_pending, head, ptr);
+		if (seen == head)
+			break;
+		head = seen;
+	}
+}
+
+/* Batch versions for ring refill / completion loops.  slab_alloc_bulk() fills
+ * @out[0..n) and returns how many it got: fewer than @n only when the free list and
+ * bump region ran dry and one slab_grow() did not cover the rest (it grows at most
+ * once per call).
+ * slab_free_bulk() threads @in[0..n) into one chain and splices it onto the free
+ * list. */
+ULONG slab_alloc_bulk(struct slab_cache *cache, ULONG n, void **out);
+void  slab_free_bulk(struct slab_cache *cache, ULONG n, void **in);
+
+/* Not for caches with a constructor: it would wipe the constructed state.  Skips the
+ * memset for a scrubbed object, and, when nothing recycled is waiting, for one from
+ * a zero-filled bump region or a fresh prezeroed slab. */
 static inline void *slab_zalloc(struct slab_cache *cache)
 {
-	void *ptr = slab_alloc(cache);
+	void *ptr = cache->clean_list;
+	if (ptr) {
+		cache->clean_list = *slab_link(cache, ptr);
+		*slab_link(cache, ptr) = NULL;
+		slab_stat_alloc(cache);
+		return ptr;
+	}
+
+	if (!cache->free_list && !cache->irq_pending) {
+		if (cache->bump != cache->bump_end) {
+			if (cache->bump_clean) {
+				ptr = cache->bump;
+				cache->bump += cache->obj_size;
+				slab_stat_alloc(cache);
+				return ptr;
+			}
+		} else if (cache->prezero) {
+			ptr = slab_grow(cache);
+			if (ptr)
+				slab_stat_alloc(cache);
+			return ptr;
+		}
+	}
+
+	ptr = slab_alloc(cache);
 	if (ptr)
 		memset(ptr, 0, cache->obj_size);
 	return ptr;
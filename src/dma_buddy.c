@@ -0,0 +1,288 @@
+// SPDX-License-Identifier: MPL-2.0 OR GPL-2.0+
+/*
+ * dma_buddy.c — binary-buddy pool for large, power-of-two DMA buffers.
+ *             See dma_mem.h for the interface.
+ *
+ * Memory comes in 1 MB superblocks, naturally aligned, carved from Emu68 RAM with
+ * dma_mem_arena_alloc().  Inside a superblock a block of order o (2^o bytes,
+ * DMA_BUDDY_MIN_SHIFT <= o <= DMA_BUDDY_MAX_SHIFT) is aligned to 2^o, and its buddy
+ * is found by flipping bit o of its offset.  Free blocks sit on one MinList per
+ * order (the MinNode lives in the free block itself) and are flagged in a per-
+ * superblock bitmap, so checking a buddy and unlinking it are O(1).  Superblocks
+ * are kept in an array sorted by base, so the owner of a pointer is a binary
+ * search.
+ *
+ * No file-scope mutable state: everything lives in the AllocMem'd pool, so this
+ * object is safe to link into ROM-resident drivers.
+ */
+
+#ifdef __INTELLISENSE__
+#include <clib/exec_protos.h>
+#else
+#define __NOLIBBASE__
+#define EXEC_BASE_NAME (*(struct ExecBase **)4UL)
+#include <proto/exec.h>
+#endif
+
+#include <exec/memory.h>
+
+#include <dma_mem.h>
+#include <minlist.h>
+#include <bits.h>
+#include <debug.h>
+
+#define DMA_BUDDY_ORDERS (DMA_BUDDY_MAX_SHIFT - DMA_BUDDY_MIN_SHIFT + 1)
+#define DMA_BUDDY_SB_SIZE (1UL << DMA_BUDDY_MAX_SHIFT)
+/* One bit per block of every order: 1 + 2 + ... + 256 = 511. */
+#define DMA_BUDDY_BITS ((2UL << (DMA_BUDDY_ORDERS - 1)) - 1)
+
+struct dma_buddy_sb
+{
+	ULONG base;
+	APTR src; /* Emu68 header the superblock came from */
+	ULONG free_bits[(DMA_BUDDY_BITS + 31) / 32];
+};
+
+struct dma_buddy
+{
+	struct dma_mem_ctx *ctx;
+	struct MinList free[DMA_BUDDY_ORDERS];
+	struct dma_buddy_sb **sbs; /* sorted by base */
+	ULONG sb_count;
+	ULONG sb_slots;
+	ULONG free_sbs; /* superblocks that are entirely free */
+};
+
+/* Bitmap index of block @offset at order index @o: orders are stored largest first
+ * (the single 1 MB block at index 0, the 256 4 KB blocks last). */
+static inline ULONG dma_buddy_bit(ULONG offset, u32 o)
+{
+	return ((1UL << (DMA_BUDDY_ORDERS - 1 - o)) - 1) + (offset >> (o + DMA_BUDDY_MIN_SHIFT));
+}
+
+static inline BOOL dma_buddy_test(const struct dma_buddy_sb *sb, ULONG bit)
+{
+	return (sb->free_bits[bit >> 5] & (1UL << (bit & 31))) != 0;
+}
+
+static inline void dma_buddy_set(struct dma_buddy_sb *sb, ULONG bit)
+{
+	sb->free_bits[bit >> 5] |= 1UL << (bit & 31);
+}
+
+static inline void dma_buddy_clear(struct dma_buddy_sb *sb, ULONG bit)
+{
+	sb->free_bits[bit >> 5] &= ~(1UL << (bit & 31));
+}
+
+/* Order index for a request, or -1 if it is larger than a superblock. */
+static LONG dma_buddy_order(ULONG size)
+{
+	if (size > DMA_BUDDY_SB_SIZE)
+		return -1;
+
+	u32 o = 0;
+	while ((1UL << (o + DMA_BUDDY_MIN_SHIFT)) < size)
+		o++;
+	return (LONG)o;
+}
+
+/* Binary search of the sorted superblock array; returns the slot of the superblock
+ * holding @a, or the insertion slot (with *found = FALSE). */
+static ULONG dma_buddy_lookup(struct dma_buddy *buddy, ULONG a, BOOL *found)
+{
+	ULONG lo = 0;
+	ULONG hi = buddy->sb_count;
+
+	while (lo < hi)
+	{
+		ULONG mid = (lo + hi) / 2;
+		ULONG base = buddy->sbs[mid]->base;
+		if (a < base)
+			hi = mid;
+		else if (a >= base + DMA_BUDDY_SB_SIZE)
+			lo = mid + 1;
+		else
+		{
+			*found = TRUE;
+			return mid;
+		}
+	}
+	*found = FALSE;
+	return lo;
+}
+
+static void dma_buddy_push(struct dma_buddy *buddy, struct dma_buddy_sb *sb, ULONG a, u32 o)
+{
+	dma_buddy_set(sb, dma_buddy_bit(a - sb->base, o));
+	AddHeadMinList(&buddy->free[o], (struct MinNode *)a);
+	if (o == DMA_BUDDY_ORDERS - 1)
+		buddy->free_sbs++;
+}
+
+static void dma_buddy_unlink(struct dma_buddy *buddy, struct dma_buddy_sb *sb, ULONG a, u32 o)
+{
+	dma_buddy_clear(sb, dma_buddy_bit(a - sb->base, o));
+	RemoveMinNode((struct MinNode *)a);
+	if (o == DMA_BUDDY_ORDERS - 1)
+		buddy->free_sbs--;
+}
+
+static BOOL dma_buddy_grow(struct dma_buddy *buddy)
+{
+	if (buddy->sb_count == buddy->sb_slots)
+	{
+		ULONG slots = buddy->sb_slots ? buddy->sb_slots * 2 : 4;
+		struct dma_buddy_sb **sbs = AllocMem(slots * sizeof(*sbs), MEMF_FAST | MEMF_PUBLIC);
+		if (sbs == NULL)
+			return FALSE;
+		if (buddy->sbs)
+		{
+			CopyMem(buddy->sbs, sbs, buddy->sb_count * sizeof(*sbs));
+			FreeMem(buddy->sbs, buddy->sb_slots * sizeof(*sbs));
+		}
+		buddy->sbs = sbs;
+		buddy->sb_slots = slots;
+	}
+
+	struct dma_buddy_sb *sb = AllocMem(sizeof(*sb), MEMF_FAST | MEMF_PUBLIC | MEMF_CLEAR);
+	if (sb == NULL)
+		return FALSE;
+
+	APTR src = NULL;
+	APTR arena = dma_mem_arena_alloc(buddy->ctx, DMA_BUDDY_SB_SIZE, DMA_BUDDY_SB_SIZE, &src);
+	if (arena == NULL)
+	{
+		Kprintf("[dma_mem] out of Emu68 RAM for a 1 MB buddy superblock\n");
+		FreeMem(sb, sizeof(*sb));
+		return FALSE;
+	}
+	sb->base = (ULONG)arena;
+	sb->src = src;
+
+	BOOL found;
+	ULONG slot = dma_buddy_lookup(buddy, sb->base, &found);
+	for (ULONG i = buddy->sb_count; i > slot; i--)
+		buddy->sbs[i] = buddy->sbs[i - 1];
+	buddy->sbs[slot] = sb;
+	buddy->sb_count++;
+
+	dma_buddy_push(buddy, sb, sb->base, DMA_BUDDY_ORDERS - 1);
+	return TRUE;
+}
+
+static void dma_buddy_release(struct dma_buddy *buddy, ULONG slot)
+{
+	struct dma_buddy_sb *sb = buddy->sbs[slot];
+
+	dma_buddy_unlink(buddy, sb, sb->base, DMA_BUDDY_ORDERS - 1);
+	for (ULONG i = slot; i + 1 < buddy->sb_count; i++)
+		buddy->sbs[i] = buddy->sbs[i + 1];
+	buddy->sb_count--;
+
+	dma_mem_arena_free(sb->src, (APTR)sb->base, DMA_BUDDY_SB_SIZE);
+	FreeMem(sb, sizeof(*sb));
+}
+
+struct dma_buddy *dma_buddy_create(struct dma_mem_ctx *ctx)
+{
+	if (ctx == NULL || ctx->count == 0)
+		return NULL;
+
+	struct dma_buddy *buddy = AllocMem(sizeof(*buddy), MEMF_FAST | MEMF_PUBLIC | MEMF_CLEAR);
+	if (buddy == NULL)
+		return NULL;
+
+	buddy->ctx = ctx;
+	for (u32 o = 0; o < DMA_BUDDY_ORDERS; o++)
+		_NewMinList(&buddy->free[o]);
+	return buddy;
+}
+
+void dma_buddy_delete(struct dma_buddy *buddy)
+{
+	if (buddy == NULL)
+		return;
+
+	for (ULONG i = 0; i < buddy->sb_count; i++)
+	{
+		struct dma_buddy_sb *sb = buddy->sbs[i];
+		dma_mem_arena_free(sb->src, (APTR)sb->base, DMA_BUDDY_SB_SIZE);
+		FreeMem(sb, sizeof(*sb));
+	}
+	if (buddy->sbs)
+		FreeMem(buddy->sbs, buddy->sb_slots * sizeof(*buddy->sbs));
+	FreeMem(buddy, sizeof(*buddy));
+}
+
+APTR dma_buddy_alloc(struct dma_buddy *buddy, ULONG size)
+{
+	LONG want = dma_buddy_order(size);
+	if (buddy == NULL || size == 0 || want < 0)
+		return NULL;
+
+	u32 o = (u32)want;
+	while (o < DMA_BUDDY_ORDERS && buddy->free[o].mlh_TailPred == (struct MinNode *)&buddy->free[o])
+		o++;
+
+	if (o == DMA_BUDDY_ORDERS)
+	{
+		if (!dma_buddy_grow(buddy))
+			return NULL;
+		o = DMA_BUDDY_ORDERS - 1;
+	}
+
+	ULONG a = (ULONG)buddy->free[o].mlh_Head;
+	BOOL found;
+	struct dma_buddy_sb *sb = buddy->sbs[dma_buddy_lookup(buddy, a, &found)];
+	dma_buddy_unlink(buddy, sb, a, o);
+
+	/* Split down to the requested order, freeing the upper half each time. */
+	while (o > (u32)want)
+	{
+		o--;
+		dma_buddy_push(buddy, sb, a + (1UL << (o + DMA_BUDDY_MIN_SHIFT)), o);
+	}
+
+	return (APTR)a;
+}
+
+void dma_buddy_free(struct dma_buddy *buddy, APTR ptr, ULONG size)
+{
+	if (buddy == NULL || ptr == NULL)
+		return;
+
+	LONG want = dma_buddy_order(size);
+	BOOL found;
+	ULONG slot = dma_buddy_lookup(buddy, (ULONG)ptr, &found);
+	if (want < 0 || !found)
+	{
+		Kprintf("[dma_mem] buddy_free: %08lx (%lu bytes) not from this pool\n", (ULONG)ptr, size);
+		return;
+	}
+
+	struct dma_buddy_sb *sb = buddy->sbs[slot];
+	ULONG offset = (ULONG)ptr - sb->base;
+	u32 o = (u32)want;
+
+	/* Coalesce with free buddies as far up as they go. */
+	while (o < DMA_BUDDY_ORDERS - 1)
+	{
+		ULONG buddy_off = offset ^ (1UL << (o + DMA_BUDDY_MIN_SHIFT));
+		if (!dma_buddy_test(sb, dma_buddy_bit(buddy_off, o)))
+			break;
+		dma_buddy_unlink(buddy, sb, sb->base + buddy_off, o);
+		offset &= ~(1UL << (o + DMA_BUDDY_MIN_SHIFT));
+		o++;
+	}
+
+	/* A whole free superblock beyond the one kept spare goes back to Emu68 RAM. */
+	if (o == DMA_BUDDY_ORDERS - 1 && buddy->free_sbs >= 1)
+	{
+		dma_buddy_push(buddy, sb, sb->base, o);
+		dma_buddy_release(buddy, slot);
+		return;
+	}
+
+	dma_buddy_push(buddy, sb, sb->base + offset, o);
+}
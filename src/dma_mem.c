@@ -28,16 +28,92 @@ extern struct ExecBase *SysBase;
 
 #include <exec/execbase.h>
 #include <exec/memory.h>
+#include <exec/semaphores.h>
 
 #include <dma_mem.h>
 #include <devtree.h>
 #include <bits.h>
 #include <debug.h>
 
-#define DMA_MEM_2GB 0x80000000UL
-/* Default arena grabbed per puddle from Emu68 RAM; large single requests get their
- * own right-sized puddle. */
-#define DMA_POOL_PUDDLE_SIZE (128UL * 1024UL)
+/* Default arena grabbed per puddle from Emu68 RAM, aligned to its size so the pool's
+ * segment map finds a block's puddle from its address; large single requests get
+ * their own right-sized puddle, which is not in the map. */
+#define DMA_POOL_PUDDLE_SHIFT 17
+#define DMA_POOL_PUDDLE_SIZE (1UL << DMA_POOL_PUDDLE_SHIFT)
+
+/* Standard puddles per dma_addr_reachable() lookup slot (one segment map leaf). */
+#define DMA_POOL_SEG_LEAF (1UL << (DMA_MEM_LOOKUP_SHIFT - DMA_POOL_PUDDLE_SHIFT))
+
+/* Size-class front end for the region sub-allocator: blocks of a power of two from
+ * 64 B to 16 KB, aligned to their size and carved from standard puddles only, are
+ * recycled through per-class free lists, so the common DMA sizes skip the first-fit
+ * Allocate() walk.  dma_alloc() rounds its payload up to a class; raw requests use
+ * one only when they are exactly a class size.  Each standard puddle keeps a byte
+ * per 64 B of arena holding the class (+ 1) of the class block starting there, so
+ * dma_free() needs no header.  Each class caches at most DMA_POOL_CLASS_CACHE_BYTES
+ * of freed blocks; beyond that they go back to their puddle.  Cached blocks count
+ * as free when deciding whether a puddle is empty (see dma_puddle_empty()). */
+#define DMA_POOL_CLASS_MIN_SHIFT 6
+#define DMA_POOL_CLASS_MAX_SHIFT 14
+#define DMA_POOL_CLASSES (DMA_POOL_CLASS_MAX_SHIFT - DMA_POOL_CLASS_MIN_SHIFT + 1)
+#define DMA_POOL_CLASS_CACHE_BYTES (64UL * 1024UL)
+
+#if DMA_POOL_CLASSES != DMA_POOL_CACHE_CLASSES
+#error "struct dma_pool_cache must have one magazine per size class"
+#endif
+#if (1UL << DMA_POOL_CLASS_MIN_SHIFT) != DMA_ALLOC_CLASS_MIN || \
+	(1UL << DMA_POOL_CLASS_MAX_SHIFT) != DMA_ALLOC_CLASS_MAX
+#error "dma_alloc_class() must round to the pool's size classes"
+#endif
+
+/* Fully empty puddles a pool keeps before returning one to Emu68 RAM (hysteresis
+ * against grow/release flapping); see dma_pool_set_spare(). */
+#define DMA_POOL_SPARE_PUDDLES 1
+
+/* Out-of-band allocations (dma_alloc_oob): open-addressed address -> size/owner
+ * table, grown at half load.  The initial size covers a typical ring or two. */
+#define DMA_OOB_MIN_SLOTS 64
+
+struct dma_oob_ent
+{
+	ULONG addr; /* 0 = empty slot */
+	ULONG size;
+	struct dma_puddle *owner;
+};
+
+#ifdef DMA_TRACK
+/* Ownership tracker (EMU68_DMA_TRACK build option -> DMA_TRACK): buffers handed to
+ * the device, with a checksum of those the device only reads.  A dma_map()ped
+ * buffer keeps its entry until dma_unmap(); the sync calls in between only move
+ * ownership back and forth. */
+#define DMA_TRACK_MAX 128
+
+struct dma_track_ent
+{
+	ULONG start;
+	ULONG end; /* exclusive */
+	ULONG dir;
+	ULONG sum; /* dma_track_sum() at hand-over; DMA_TO_DEVICE only */
+	BOOL mapped; /* from dma_map(); only dma_unmap() removes it */
+	BOOL device; /* the device owns it now; always TRUE unless @mapped */
+};
+#endif
+
+#ifdef MEM_STATS
+/* Request-size histogram: bucket 0 is <= 16 bytes, bucket i covers
+ * (8 << i, 16 << i], the last bucket everything larger (> 256 KB). */
+#define DMA_STATS_BUCKETS 16
+
+struct dma_pool_stats
+{
+	ULONG allocs;
+	ULONG frees;
+	ULONG failures;
+	ULONG bytes_high; /* peak of pool->in_use less @mag_bytes */
+	ULONG mag_bytes;  /* of pool->in_use, parked in task magazines (as of the last fold) */
+	ULONG size_hist[DMA_STATS_BUCKETS];
+};
+#endif
 
 struct dma_puddle
 {
@@ -45,6 +121,9 @@ struct dma_puddle
 	struct MemHeader *src; /* system header the arena was Allocate()'d from */
 	APTR arena;
 	ULONG arena_size;
+	ULONG cached;		 /* bytes of this arena parked in the pool's class caches */
+	UBYTE *classes;		 /* class + 1 per 64 B granule starting a class block; NULL
+						  * unless a standard puddle (then right after this struct) */
 	struct MemHeader mh; /* private sub-allocator over [arena, arena+arena_size) */
 };
 
@@ -53,13 +132,184 @@ struct dma_pool
 	struct dma_mem_ctx *ctx;
 	struct dma_puddle *puddles;
 	ULONG puddle_size;
+	ULONG empty_puddles; /* puddles with no live block (dma_puddle_empty) */
+	ULONG spare_puddles; /* empty puddles kept before releasing */
+
+	/* Address window every arena must lie in (dma_pool_create_limited); 0 and
+	 * DMA_MEM_LIMIT_NONE for an unrestricted pool. */
+	ULONG floor;
+	ULONG limit;
+
+	/* Byte accounting: Emu68 RAM held in puddle arenas, and region bytes handed out
+	 * (after class/block rounding).  A non-zero @reserve (dma_pool_reserve) keeps at
+	 * least that much headroom grabbed, disables growth on the allocation path, and
+	 * raises @refill_pending when headroom drops below @low_water.  It also keeps
+	 * the free path from releasing puddles: @surplus_pending marks empty ones
+	 * dma_pool_refill() / dma_pool_trim() should give back. */
+	ULONG arena_bytes;
+	ULONG in_use;
+	ULONG reserve;
+	ULONG low_water;
+	BOOL refill_pending;
+	BOOL surplus_pending;
+
+	/* Bounce slots (dma_pool_bounce_init); free slots are chained through their
+	 * first word, like slab objects. */
+	APTR bounce_free;
+	ULONG bounce_slot_size;
+
+	/* Size-class caches: freed blocks chained through their first word.  In
+	 * concurrent mode they are the depot behind the per-task magazines. */
+	APTR class_free[DMA_POOL_CLASSES];
+	ULONG class_cached[DMA_POOL_CLASSES];
+
+	/* Segment map: standard puddle per DMA_POOL_PUDDLE_SIZE of address space, in
+	 * leaves of DMA_POOL_SEG_LEAF allocated on first use and kept until
+	 * dma_pool_delete().  An entry only changes while its puddle holds no live
+	 * block, so dma_free() and dma_cache_free() read it without the lock. */
+	struct dma_puddle **seg[DMA_MEM_LOOKUP_SLOTS];
+
+	/* dma_alloc_oob bookkeeping. */
+	struct dma_oob_ent *oob;
+	ULONG oob_slots; /* power of two, or 0 before the first oob allocation */
+	ULONG oob_count;
+
+	/* Concurrent mode (dma_pool_enable_concurrent): @lock serialises everything
+	 * except the magazine fast path. */
+	BOOL concurrent;
+	struct SignalSemaphore lock;
+
+#ifdef MEM_STATS
+	struct dma_pool_stats stats;
+#endif
+#ifdef DMA_TRACK
+	struct dma_track_ent track[DMA_TRACK_MAX];
+	ULONG track_count;
+#endif
 };
 
+/* Build the merged range table and the per-slot lookup behind dma_addr_reachable()
+ * from the regions just discovered.  Headers are sorted by address and any that
+ * touch or overlap are merged, so a buffer straddling two adjacent Emu68 headers is
+ * still one reachable range. */
+static void dma_mem_build_lookup(struct dma_mem_ctx *ctx)
+{
+	const struct dma_mem_region *regions = dma_mem_regions(ctx);
+	struct dma_mem_range *ranges = dma_mem_ranges(ctx);
+	u32 n = 0;
+
+	for (u32 i = 0; i < ctx->count; i++)
+	{
+		ULONG start = regions[i].start;
+		ULONG end = regions[i].end;
+
+		/* Insertion sort: one entry per Emu68 header, a handful on real boards. */
+		u32 j = n;
+		while (j > 0 && ranges[j - 1].start > start)
+		{
+			ranges[j] = ranges[j - 1];
+			j--;
+		}
+		ranges[j].start = start;
+		ranges[j].end = end;
+		n++;
+	}
+
+	u32 merged = 0;
+	for (u32 i = 0; i < n; i++)
+	{
+		if (merged > 0 && ranges[i].start <= ranges[merged - 1].end)
+		{
+			if (ranges[i].end > ranges[merged - 1].end)
+				ranges[merged - 1].end = ranges[i].end;
+			continue;
+		}
+		ranges[merged++] = ranges[i];
+	}
+	ctx->range_count = merged;
+
+	u32 r = 0;
+	for (ULONG slot = 0; slot < DMA_MEM_LOOKUP_SLOTS; slot++)
+	{
+		ULONG base = slot << DMA_MEM_LOOKUP_SHIFT;
+		while (r < merged && ranges[r].end <= base)
+			r++;
+		ctx->lookup[slot] = (u8)r;
+	}
+
+	for (u32 i = 0; i < merged; i++)
+		KprintfH("[dma_mem] reachable range %lu: %08lx..%08lx\n",
+				 (ULONG)i, ranges[i].start, ranges[i].end - 1);
+}
+
+/* Size @ctx's tables for @need regions: the inline arrays when they suffice,
+ * otherwise one heap block (capped at DMA_MEM_MAX_RANGES).  Returns the capacity. */
+static u32 dma_mem_size_tables(struct dma_mem_ctx *ctx, u32 need)
+{
+	if (need <= DMA_MEM_MAX_REGIONS)
+		return ctx->capacity;
+
+	if (need > DMA_MEM_MAX_RANGES)
+		need = DMA_MEM_MAX_RANGES;
+
+	ULONG bytes = need * (sizeof(struct dma_mem_region) + sizeof(struct dma_mem_range));
+	APTR heap = AllocMem(bytes, MEMF_PUBLIC | MEMF_CLEAR);
+	if (heap == NULL)
+	{
+		Kprintf("[dma_mem] no memory for %lu DMA regions; only the first %lu are used\n",
+				(ULONG)need, (ULONG)DMA_MEM_MAX_REGIONS);
+		return ctx->capacity;
+	}
+
+	ctx->heap = heap;
+	ctx->capacity = need;
+	return need;
+}
+
+void dma_mem_exit(struct dma_mem_ctx *ctx)
+{
+	if (ctx == NULL)
+		return;
+
+	if (ctx->capacity > DMA_MEM_MAX_REGIONS)
+		FreeMem(ctx->heap, ctx->capacity * (sizeof(struct dma_mem_region) + sizeof(struct dma_mem_range)));
+	ctx->heap = NULL;
+	ctx->capacity = DMA_MEM_MAX_REGIONS;
+	ctx->count = 0;
+	ctx->range_count = 0;
+}
+
+/* The header lies inside one of the Pi-DRAM windows. */
+static BOOL dma_mem_in_windows(const struct MemHeader *mh, const struct dma_mem_range *windows, u32 window_count)
+{
+	if ((mh->mh_Attributes & MEMF_FAST) == 0)
+		return FALSE;
+
+	ULONG lo = (ULONG)mh->mh_Lower;
+	ULONG hi = (ULONG)mh->mh_Upper;
+	for (u32 i = 0; i < window_count; i++)
+	{
+		if (lo >= windows[i].start && hi <= windows[i].end)
+			return TRUE;
+	}
+	return FALSE;
+}
+
 void dma_mem_init(struct dma_mem_ctx *ctx)
 {
 	if (ctx == NULL)
 		return;
 	ctx->count = 0;
+	ctx->range_count = 0;
+	ctx->capacity = DMA_MEM_MAX_REGIONS;
+	ctx->heap = NULL;
+
+	/* Drivers have always handed CPU addresses to the hardware; keep that until
+	 * dma_mem_bus_init() says otherwise. */
+	ctx->bus_count = 1;
+	ctx->bus[0].cpu_start = 0;
+	ctx->bus[0].cpu_last = 0xffffffffUL;
+	ctx->bus[0].offset = 0;
 
 	APTR DeviceTreeBase = OpenResource((CONST_STRPTR) "devicetree.resource");
 	if (DeviceTreeBase == NULL)
@@ -76,7 +326,7 @@ void dma_mem_init(struct dma_mem_ctx *ctx)
 	}
 
 	const u32 *reg = DT_GetPropValue(mem_prop); /* DT cells are 32-bit; matches DT_GetNumber's param on any NDK */
-	ULONG cells = DT_GetPropLen(mem_prop) / sizeof(ULONG);
+	ULONG cells = DT_GetPropLen(mem_prop) / sizeof(u32);
 
 	/* DT spec defaults (and the convention used throughout this stack): 2 address
 	 * cells, 1 size cell.  The root /memory layout is read with DT_GetNumber so
@@ -88,12 +338,28 @@ void dma_mem_init(struct dma_mem_ctx *ctx)
 	/* Parse the raw /memory window(s): the Pi-DRAM physical extent.  These are used
 	 * only to discriminate which MEMF_FAST headers are Emu68 RAM (Zorro III /
 	 * accelerator Fast RAM never falls inside them); the authoritative DMA-reachable
-	 * ranges are the kept headers' bounds, recorded below. */
-	struct dma_mem_region windows[DMA_MEM_MAX_REGIONS];
+	 * ranges are the kept headers' bounds, recorded below.  A /memory node with more
+	 * entries than fit on the stack gets a temporary heap table. */
+	struct dma_mem_range window_buf[DMA_MEM_MAX_REGIONS];
+	struct dma_mem_range *windows = window_buf;
+	ULONG window_max = DMA_MEM_MAX_REGIONS;
+	ULONG entries = addr_cells + size_cells ? cells / (addr_cells + size_cells) : 0;
+	if (entries > DMA_MEM_MAX_REGIONS)
+	{
+		windows = AllocMem(entries * sizeof(*windows), MEMF_PUBLIC);
+		if (windows)
+			window_max = entries;
+		else
+		{
+			windows = window_buf;
+			Kprintf("[dma_mem] no memory for %lu /memory entries; only the first %lu are used\n",
+					entries, window_max);
+		}
+	}
 	u32 window_count = 0;
 
 	ULONG pos = 0;
-	while (pos + addr_cells + size_cells <= cells && window_count < DMA_MEM_MAX_REGIONS)
+	while (pos + addr_cells + size_cells <= cells && window_count < window_max)
 	{
 		u64 base = DT_GetNumber(&reg[pos], addr_cells);
 		pos += addr_cells;
@@ -120,156 +386,1762 @@ void dma_mem_init(struct dma_mem_ctx *ctx)
 	 * space, removed/split sub-ranges and the 2GB straddle. */
 	struct ExecBase *eb = EXEC_BASE_NAME;
 	Forbid();
-	for (struct MemHeader *mh = (struct MemHeader *)eb->MemList.lh_Head;
-		 mh->mh_Node.ln_Succ != NULL && ctx->count < DMA_MEM_MAX_REGIONS;
+	u32 found = 0;
+	for (struct MemHeader *mh = (struct MemHeader *)eb->MemList.lh_Head; mh->mh_Node.ln_Succ != NULL;
 		 mh = (struct MemHeader *)mh->mh_Node.ln_Succ)
 	{
-		if ((mh->mh_Attributes & MEMF_FAST) == 0)
-			continue;
+		if (dma_mem_in_windows(mh, windows, window_count))
+			found++;
+	}
 
-		ULONG lo = (ULONG)mh->mh_Lower;
-		ULONG hi = (ULONG)mh->mh_Upper;
-		for (u32 i = 0; i < window_count; i++)
+	u32 capacity = dma_mem_size_tables(ctx, found);
+	struct dma_mem_region *regions = dma_mem_regions(ctx);
+	for (struct MemHeader *mh = (struct MemHeader *)eb->MemList.lh_Head;
+		 mh->mh_Node.ln_Succ != NULL && ctx->count < capacity;
+		 mh = (struct MemHeader *)mh->mh_Node.ln_Succ)
+	{
+		if (dma_mem_in_windows(mh, windows, window_count))
 		{
-			if (lo >= windows[i].start && hi <= windows[i].end)
-			{
-				ctx->regions[ctx->count].start = lo;
-				ctx->regions[ctx->count].end = hi;
-				ctx->regions[ctx->count].header = mh;
-				ctx->count++;
-				break;
-			}
+			regions[ctx->count].start = (ULONG)mh->mh_Lower;
+			regions[ctx->count].end = (ULONG)mh->mh_Upper;
+			regions[ctx->count].header = mh;
+			ctx->count++;
 		}
 	}
 	Permit();
 
+	if (windows != window_buf)
+		FreeMem(windows, window_max * sizeof(*windows));
+	if (ctx->count < found)
+		Kprintf("[dma_mem] %lu of %lu Emu68 RAM headers not used for DMA\n",
+				(ULONG)(found - ctx->count), (ULONG)found);
+
 	for (u32 i = 0; i < ctx->count; i++)
 		KprintfH("[dma_mem] Emu68 DMA region %lu: %08lx..%08lx\n",
-				 (ULONG)i, ctx->regions[i].start, ctx->regions[i].end - 1);
+				 (ULONG)i, regions[i].start, regions[i].end - 1);
 	KprintfH("[dma_mem] %lu Emu68 RAM header(s) usable for DMA\n", (ULONG)ctx->count);
+
+	dma_mem_build_lookup(ctx);
 }
 
 /* dma_addr_reachable() is now a static inline in dma_mem.h (per-I/O hot path). */
 
-/* --- Region pool ------------------------------------------------------------- */
+/* --- Bus-address translation (dma-ranges) --- */
 
-static struct dma_puddle *dma_pool_grow(struct dma_pool *pool, ULONG need)
+/* One window while composing levels: [addr, addr + size) at the current level maps
+ * to [bus, bus + size) on the device's bus. */
+struct dma_bus_window
 {
-	ULONG arena_size = need > pool->puddle_size ? need : pool->puddle_size;
-	arena_size = ALIGN_UP(arena_size, MEM_BLOCKSIZE);
+	u64 bus;
+	u64 addr;
+	u64 size;
+};
 
-	APTR arena = NULL;
-	struct MemHeader *src = NULL;
-	Forbid();
-	for (u32 i = 0; i < pool->ctx->count; i++)
+#define DMA_BUS_4GB 0x100000000ULL
+
+BOOL dma_mem_bus_init(struct dma_mem_ctx *ctx, CONST_STRPTR path)
+{
+	if (ctx == NULL || path == NULL)
+		return FALSE;
+
+	APTR DeviceTreeBase = OpenResource((CONST_STRPTR) "devicetree.resource");
+	if (DeviceTreeBase == NULL)
+		return FALSE;
+
+	APTR key = DT_OpenKey(path);
+	if (key == NULL)
+	{
+		Kprintf("[dma_mem] %s: no such node %s\n", __func__, path);
+		return FALSE;
+	}
+
+	/* Start from the identity and push it up one level per node: each dma-ranges
+	 * entry maps [child, child + size) of this node's bus to [parent, ...) of its
+	 * parent's, so a window survives only where an entry covers it. */
+	struct dma_bus_window win[DMA_BUS_MAX_RANGES];
+	u32 count = 1;
+	win[0].bus = 0;
+	win[0].addr = 0;
+	win[0].size = DMA_BUS_4GB;
+	BOOL dropped = FALSE;
+
+	for (APTR node = key; node != NULL && count > 0; node = DT_GetParent(node))
+	{
+		APTR parent = DT_GetParent(node);
+		APTR prop = DT_FindProperty(node, (CONST_STRPTR) "dma-ranges");
+		if (parent == NULL || prop == NULL || DT_GetPropLen(prop) == 0)
+			continue;
+
+		ULONG child_cells = DT_GetPropertyValueULONG(node, "#address-cells", 2, FALSE);
+		ULONG size_cells = DT_GetPropertyValueULONG(node, "#size-cells", 1, FALSE);
+		ULONG parent_cells = DT_GetPropertyValueULONG(parent, "#address-cells", 2, FALSE);
+		ULONG stride = child_cells + parent_cells + size_cells;
+		const u32 *cell = DT_GetPropValue(prop);
+		ULONG cells = DT_GetPropLen(prop) / sizeof(u32);
+
+		struct dma_bus_window next[DMA_BUS_MAX_RANGES];
+		u32 next_count = 0;
+		for (ULONG pos = 0; stride && pos + stride <= cells; pos += stride)
+		{
+			u64 child = DT_GetNumber(&cell[pos], child_cells);
+			u64 up = DT_GetNumber(&cell[pos + child_cells], parent_cells);
+			u64 size = DT_GetNumber(&cell[pos + child_cells + parent_cells], size_cells);
+
+			for (u32 i = 0; i < count; i++)
+			{
+				u64 lo = win[i].addr > child ? win[i].addr : child;
+				u64 hi_w = win[i].addr + win[i].size;
+				u64 hi_e = child + size;
+				u64 hi = hi_w < hi_e ? hi_w : hi_e;
+				if (lo >= hi)
+					continue;
+
+				if (next_count == DMA_BUS_MAX_RANGES)
+				{
+					dropped = TRUE;
+					continue;
+				}
+				next[next_count].bus = win[i].bus + (lo - win[i].addr);
+				next[next_count].addr = up + (lo - child);
+				next[next_count].size = hi - lo;
+				next_count++;
+			}
+		}
+
+		CopyMem(next, win, next_count * sizeof(next[0]));
+		count = next_count;
+	}
+	DT_CloseKey(key);
+
+	if (dropped)
+		Kprintf("[dma_mem] %s: more than %lu DMA windows under %s; extra ignored\n",
+				__func__, (ULONG)DMA_BUS_MAX_RANGES, path);
+
+	/* Keep what both sides can express in 32 bits. */
+	struct dma_bus_range bus[DMA_BUS_MAX_RANGES];
+	u32 bus_count = 0;
+	for (u32 i = 0; i < count; i++)
+	{
+		u64 end = win[i].addr + win[i].size;
+		if (end > DMA_BUS_4GB)
+			end = DMA_BUS_4GB;
+		if (win[i].bus < DMA_BUS_4GB && win[i].bus + (end - win[i].addr) > DMA_BUS_4GB)
+			end = win[i].addr + (DMA_BUS_4GB - win[i].bus);
+		if (win[i].bus >= DMA_BUS_4GB || win[i].addr >= end)
+		{
+			Kprintf("[dma_mem] %s: DMA window at bus %08lx%08lx unusable from a 32-bit CPU\n",
+					__func__, (ULONG)(win[i].bus >> 32), (ULONG)win[i].bus);
+			continue;
+		}
+
+		bus[bus_count].cpu_start = (ULONG)win[i].addr;
+		bus[bus_count].cpu_last = (ULONG)(end - 1);
+		bus[bus_count].offset = (ULONG)(win[i].bus - win[i].addr);
+		KprintfH("[dma_mem] %s: cpu %08lx..%08lx -> bus %08lx\n", __func__,
+				 bus[bus_count].cpu_start, bus[bus_count].cpu_last, (ULONG)win[i].bus);
+		bus_count++;
+	}
+
+	if (bus_count == 0)
+	{
+		Kprintf("[dma_mem] %s: no usable DMA window under %s\n", __func__, path);
+		return FALSE;
+	}
+
+	CopyMem(bus, ctx->bus, bus_count * sizeof(bus[0]));
+	ctx->bus_count = bus_count;
+	return TRUE;
+}
+
+ULONG dma_sg_build(struct dma_mem_ctx *ctx, APTR addr, ULONG len,
+				   struct dma_sg_seg *segs, ULONG max_segs)
+{
+	if (len == 0 || segs == NULL || max_segs == 0)
+		return 0;
+
+	ULONG a = (ULONG)addr;
+	ULONG end = a + len;
+
+	if (ctx == NULL || ctx->count == 0 || end < a)
+	{
+		segs[0].addr = addr;
+		segs[0].len = len;
+		segs[0].reachable = dma_addr_reachable(ctx, addr, len);
+		return 1;
+	}
+
+	const struct dma_mem_range *ranges = dma_mem_ranges(ctx);
+	ULONG n = 0;
+	ULONG cur = a;
+	u32 i = cur < DMA_MEM_2GB ? ctx->lookup[cur >> DMA_MEM_LOOKUP_SHIFT] : ctx->range_count;
+
+	while (cur < end)
 	{
-		struct MemHeader *mh = (struct MemHeader *)pool->ctx->regions[i].header;
-		arena = Allocate(mh, arena_size);
-		if (arena)
+		while (i < ctx->range_count && ranges[i].end <= cur)
+			i++;
+
+		/* Ranges are merged, so runs strictly alternate: inside range i up to its
+		 * end, or in the gap up to the next range's start. */
+		BOOL reachable = i < ctx->range_count && cur >= ranges[i].start;
+		ULONG stop = end;
+		if (reachable)
+			stop = ranges[i].end;
+		else if (i < ctx->range_count)
+			stop = ranges[i].start;
+		if (stop > end)
+			stop = end;
+
+		if (n == max_segs)
 		{
-			src = mh;
+			/* Out of entries: fold the remainder into the last run and bounce it. */
+			segs[n - 1].len = end - (ULONG)segs[n - 1].addr;
+			segs[n - 1].reachable = FALSE;
 			break;
 		}
+
+		segs[n].addr = (APTR)cur;
+		segs[n].len = stop - cur;
+		segs[n].reachable = reachable;
+		n++;
+		cur = stop;
 	}
-	Permit();
-	if (arena == NULL)
+
+	return n;
+}
+
+/* --- Arena grab -------------------------------------------------------------- */
+
+/* Take an aligned @size bytes from the part of @mh inside [floor, limit] by walking
+ * its free chunks and claiming the first fit with AllocAbs() (the Emu68 headers are
+ * on the system memory list).  Caller holds Forbid(). */
+static APTR dma_mem_arena_alloc_in(struct MemHeader *mh, ULONG size, ULONG align, ULONG floor,
+								   ULONG limit)
+{
+	for (struct MemChunk *mc = mh->mh_First; mc; mc = mc->mc_Next)
 	{
-		Kprintf("[dma_mem] out of Emu68 RAM for %lu-byte DMA arena\n", arena_size);
-		return NULL;
+		ULONG lo = (ULONG)mc > floor ? (ULONG)mc : floor;
+		ULONG hi = (ULONG)mc + mc->mc_Bytes - 1;
+		if (hi > limit)
+			hi = limit;
+
+		lo = ALIGN_UP(lo, align);
+		if (lo < floor || lo > hi || hi - lo < size - 1)
+			continue;
+
+		return AllocAbs(size, (APTR)lo);
 	}
+	return NULL;
+}
 
-	struct dma_puddle *pud = AllocMem(sizeof(*pud), MEMF_FAST | MEMF_PUBLIC | MEMF_CLEAR);
-	if (pud == NULL)
+APTR dma_mem_arena_alloc_window(struct dma_mem_ctx *ctx, ULONG size, ULONG align, ULONG floor,
+								ULONG limit, APTR *src)
+{
+	size = ALIGN_UP(size, MEM_BLOCKSIZE);
+	if (align < MEM_BLOCKSIZE)
+		align = MEM_BLOCKSIZE;
+
+	/* Over-allocate by the alignment slack, then hand the unused head and tail back
+	 * to the header: the arena costs exactly @size bytes of Emu68 RAM. */
+	ULONG total = size + align - MEM_BLOCKSIZE;
+	const struct dma_mem_region *regions = dma_mem_regions(ctx);
+	APTR arena = NULL;
+
+	Forbid();
+	for (u32 i = 0; i < ctx->count && arena == NULL; i++)
 	{
-		Forbid();
-		Deallocate(src, arena, arena_size);
-		Permit();
-		return NULL;
+		struct MemHeader *mh = (struct MemHeader *)regions[i].header;
+		ULONG start = regions[i].start;
+		ULONG last = regions[i].end - 1;
+
+		if (last < floor || start > limit)
+			continue;
+
+		/* A header straddling the window: only its inside part will do. */
+		if (start < floor || last > limit)
+		{
+			arena = dma_mem_arena_alloc_in(mh, size, align, floor, limit);
+			if (arena)
+				*src = mh;
+			continue;
+		}
+
+		UBYTE *raw = Allocate(mh, total);
+		if (raw == NULL)
+			continue;
+
+		UBYTE *aligned = (UBYTE *)ALIGN_UP((ULONG)raw, align);
+		ULONG head = (ULONG)(aligned - raw);
+		ULONG tail = total - head - size;
+		if (head)
+			Deallocate(mh, raw, head);
+		if (tail)
+			Deallocate(mh, aligned + size, tail);
+
+		arena = aligned;
+		*src = mh;
 	}
+	Permit();
 
-	pud->src = src;
-	pud->arena = arena;
-	pud->arena_size = arena_size;
+	return arena;
+}
 
-	/* Private MemHeader managing this arena via Exec Allocate/Deallocate. */
-	pud->mh.mh_Attributes = MEMF_FAST;
-	pud->mh.mh_First = (struct MemChunk *)arena;
-	pud->mh.mh_Lower = arena;
-	pud->mh.mh_Upper = (APTR)((ULONG)arena + arena_size);
-	pud->mh.mh_Free = arena_size;
-	((struct MemChunk *)arena)->mc_Next = NULL;
-	((struct MemChunk *)arena)->mc_Bytes = arena_size;
+APTR dma_mem_arena_alloc(struct dma_mem_ctx *ctx, ULONG size, ULONG align, APTR *src)
+{
+	return dma_mem_arena_alloc_window(ctx, size, align, 0, DMA_MEM_LIMIT_NONE, src);
+}
 
-	pud->next = pool->puddles;
-	pool->puddles = pud;
-	return pud;
+void dma_mem_arena_free(APTR src, APTR arena, ULONG size)
+{
+	Forbid();
+	Deallocate((struct MemHeader *)src, arena, ALIGN_UP(size, MEM_BLOCKSIZE));
+	Permit();
 }
 
-APTR dma_pool_region_alloc(struct dma_pool *pool, ULONG size)
+/* --- Ownership tracker ------------------------------------------------------- */
+
+#ifdef DMA_TRACK
+static ULONG dma_track_sum(ULONG start, ULONG end)
 {
-	ULONG need = ALIGN_UP(size, MEM_BLOCKSIZE);
+	ULONG sum = 0;
+	for (const UBYTE *p = (const UBYTE *)start; p < (const UBYTE *)end; p++)
+		sum = ((sum << 5) | (sum >> 27)) ^ *p;
+	return sum;
+}
 
-	for (struct dma_puddle *pud = pool->puddles; pud; pud = pud->next)
+/* Index of the first tracked buffer overlapping [start, end), or -1. */
+static LONG dma_track_find(struct dma_pool *pool, ULONG start, ULONG end)
+{
+	for (ULONG i = 0; i < pool->track_count; i++)
 	{
-		APTR ptr = Allocate(&pud->mh, need);
-		if (ptr)
-			return ptr;
+		if (pool->track[i].start < end && start < pool->track[i].end)
+			return (LONG)i;
 	}
+	return -1;
+}
 
-	struct dma_puddle *pud = dma_pool_grow(pool, need);
-	if (pud == NULL)
-		return NULL;
-	return Allocate(&pud->mh, need);
+/* Index of the first tracked buffer containing [start, end), or -1. */
+static LONG dma_track_find_within(struct dma_pool *pool, ULONG start, ULONG end)
+{
+	for (ULONG i = 0; i < pool->track_count; i++)
+	{
+		if (pool->track[i].start <= start && end <= pool->track[i].end)
+			return (LONG)i;
+	}
+	return -1;
 }
 
-void dma_pool_region_free(struct dma_pool *pool, APTR ptr, ULONG size)
+/* Index of the first tracked buffer sharing a cache line with [start, end) when
+ * either side is device-written, or -1.  Only meaningful for buffers that do not
+ * overlap: the invalidate after the transfer then drops the other's bytes. */
+static LONG dma_track_find_line(struct dma_pool *pool, ULONG start, ULONG end, ULONG dir)
 {
-	if (ptr == NULL)
-		return;
+	ULONG lstart = start & ~(ULONG)DMA_ALIGN_MIN_MASK;
+	ULONG lend = ALIGN_UP(end, DMA_ALIGN_MIN);
 
-	ULONG need = ALIGN_UP(size, MEM_BLOCKSIZE);
-	ULONG a = (ULONG)ptr;
+	for (ULONG i = 0; i < pool->track_count; i++)
+	{
+		const struct dma_track_ent *t = &pool->track[i];
+		if (((dir | t->dir) & DMA_FROM_DEVICE) && (t->start & ~(ULONG)DMA_ALIGN_MIN_MASK) < lend &&
+			lstart < ALIGN_UP(t->end, DMA_ALIGN_MIN))
+			return (LONG)i;
+	}
+	return -1;
+}
 
-	for (struct dma_puddle *pud = pool->puddles; pud; pud = pud->next)
+/* [addr, addr+len) passes to the device for a @dir transfer: from dma_map() when
+ * @map, else from a sync call.  Syncing (part of) a mapped buffer only hands it
+ * back if dma_sync_for_cpu() took it, so map + sync_for_device is not a double
+ * hand-over.  Only the pool's own table is touched; Disable() because sync calls
+ * may come from interrupt code. */
+static void dma_track_give(struct dma_pool *pool, APTR addr, ULONG len, ULONG dir, BOOL map,
+						   const char *what)
+{
+	ULONG start = (ULONG)addr;
+	ULONG end = start + len;
+
+	if (pool == NULL || len == 0)
+		return;
+
+	Disable();
+	LONG i = dma_track_find(pool, start, end);
+	if (i >= 0 && !map && pool->track[i].mapped && start >= pool->track[i].start &&
+		end <= pool->track[i].end)
 	{
-		if (a >= (ULONG)pud->mh.mh_Lower && a < (ULONG)pud->mh.mh_Upper)
+		struct dma_track_ent *t = &pool->track[i];
+		if (!t->device)
 		{
-			Deallocate(&pud->mh, ptr, need);
-			return;
+			t->device = TRUE;
+			if (t->dir == DMA_TO_DEVICE)
+				t->sum = dma_track_sum(t->start, t->end);
 		}
+		Enable();
+		return;
+	}
+
+	if (i >= 0)
+	{
+		Kprintf("[dma_track] %s: %08lx+%lu already owned by the device (%08lx+%lu)\n", what,
+				start, len, pool->track[i].start, pool->track[i].end - pool->track[i].start);
+	}
+	else if ((i = dma_track_find_line(pool, start, end, dir)) >= 0)
+	{
+		Kprintf("[dma_track] %s: %08lx+%lu shares a cache line with device-owned %08lx+%lu\n",
+				what, start, len, pool->track[i].start, pool->track[i].end - pool->track[i].start);
 	}
-	Kprintf("[dma_mem] region_free: %08lx not from this pool\n", a);
+	else if (!map && (dir & DMA_FROM_DEVICE) && ((start | end) & DMA_ALIGN_MIN_MASK))
+	{
+		/* The post-DMA invalidate drops whatever else lives in a partial line.
+		 * Untracked (CPU-owned) bytes there cannot be told from slack, so every
+		 * partial line is reported.  dma_map() needs no check: it only maps whole
+		 * lines in place, and a bounce slot owns the rest of its last line. */
+		Kprintf("[dma_track] %s: %08lx+%lu does not start and end on a cache line\n",
+				what, start, len);
+	}
+
+	if (pool->track_count < DMA_TRACK_MAX)
+	{
+		struct dma_track_ent *t = &pool->track[pool->track_count++];
+		t->start = start;
+		t->end = end;
+		t->dir = dir;
+		t->sum = dir == DMA_TO_DEVICE ? dma_track_sum(start, end) : 0;
+		t->mapped = map;
+		t->device = TRUE;
+	}
+	else
+		Kprintf("[dma_track] %s: table full, %08lx+%lu not tracked\n", what, start, len);
+	Enable();
 }
 
-struct dma_pool *dma_pool_create(struct dma_mem_ctx *ctx)
+/* Tracked buffer @i comes back to the CPU. */
+static void dma_track_take_ent(struct dma_pool *pool, ULONG i, BOOL unmap, const char *what)
 {
-	if (ctx == NULL || ctx->count == 0)
-		return NULL;
-
-	struct dma_pool *pool = AllocMem(sizeof(*pool), MEMF_FAST | MEMF_PUBLIC | MEMF_CLEAR);
-	if (pool == NULL)
-		return NULL;
+	struct dma_track_ent *t = &pool->track[i];
 
-	pool->ctx = ctx;
-	pool->puddles = NULL;
-	pool->puddle_size = DMA_POOL_PUDDLE_SIZE;
-	return pool;
+	if (t->device && t->dir == DMA_TO_DEVICE && dma_track_sum(t->start, t->end) != t->sum)
+		Kprintf("[dma_track] %s: CPU wrote %08lx+%lu while the device owned it\n", what,
+				t->start, t->end - t->start);
+	if (unmap || !t->mapped)
+		*t = pool->track[--pool->track_count];
+	else
+		t->device = FALSE;
 }
 
-void dma_pool_delete(struct dma_pool *pool)
+/* [addr, addr+len) comes back to the CPU: for good when @unmap, else from a sync
+ * call, which leaves a mapped buffer's entry in place (taking it twice is fine).
+ * A range inside one tracked buffer (a sub-range sync) takes that buffer back;
+ * otherwise every buffer inside the range does, as when a dma_sync_*_batch() array
+ * coalesced by the hand-over comes back whole lines at a time. */
+static void dma_track_take(struct dma_pool *pool, APTR addr, ULONG len, BOOL unmap,
+						   const char *what)
 {
-	if (pool == NULL)
+	ULONG start = (ULONG)addr;
+	ULONG end = start + len;
+
+	if (pool == NULL || len == 0)
 		return;
 
-	struct dma_puddle *pud = pool->puddles;
-	while (pud)
+	Disable();
+	LONG i = dma_track_find_within(pool, start, end);
+	if (i >= 0)
 	{
-		struct dma_puddle *next = pud->next;
-		Forbid();
-		Deallocate(pud->src, pud->arena, pud->arena_size);
-		Permit();
-		FreeMem(pud, sizeof(*pud));
-		pud = next;
+		dma_track_take_ent(pool, (ULONG)i, unmap, what);
+		Enable();
+		return;
 	}
-	FreeMem(pool, sizeof(*pool));
+
+	BOOL found = FALSE;
+	for (ULONG j = pool->track_count; j-- > 0;)
+	{
+		if (start <= pool->track[j].start && pool->track[j].end <= end)
+		{
+			dma_track_take_ent(pool, j, unmap, what);
+			found = TRUE;
+		}
+	}
+	if (!found)
+		Kprintf("[dma_track] %s: %08lx+%lu is not a device-owned buffer\n", what, start, len);
+	Enable();
+}
+
+/* A block of the pool is being freed: nothing in it may still be device-owned or
+ * mapped. */
+static void dma_track_check_free(struct dma_pool *pool, APTR ptr, ULONG size)
+{
+	Disable();
+	LONG i = dma_track_find(pool, (ULONG)ptr, (ULONG)ptr + size);
+	if (i >= 0)
+		Kprintf("[dma_track] free of %08lx+%lu while %08lx+%lu is still %s\n", (ULONG)ptr, size,
+				pool->track[i].start, pool->track[i].end - pool->track[i].start,
+				pool->track[i].device ? "owned by the device" : "mapped");
+	Enable();
 }
+#else
+#define dma_track_give(pool, addr, len, dir, map, what) ((void)0)
+#define dma_track_take(pool, addr, len, unmap, what) ((void)0)
+#define dma_track_check_free(pool, ptr, size) ((void)0)
+#endif
+
+/* --- Region pool ------------------------------------------------------------- */
+
+/* Bytes of the puddle struct allocation: a standard puddle carries its class map. */
+static inline ULONG dma_puddle_meta_size(const struct dma_puddle *pud)
+{
+	return sizeof(*pud) + (pud->classes ? pud->arena_size >> DMA_POOL_CLASS_MIN_SHIFT : 0);
+}
+
+/* Slot of @addr's segment in the map, allocating its leaf when @create. */
+static struct dma_puddle **dma_pool_seg_slot(struct dma_pool *pool, ULONG addr, BOOL create)
+{
+	struct dma_puddle **leaf = pool->seg[addr >> DMA_MEM_LOOKUP_SHIFT];
+	if (leaf == NULL && create)
+	{
+		leaf = AllocMem(DMA_POOL_SEG_LEAF * sizeof(*leaf), MEMF_FAST | MEMF_PUBLIC | MEMF_CLEAR);
+		pool->seg[addr >> DMA_MEM_LOOKUP_SHIFT] = leaf;
+	}
+	return leaf ? &leaf[(addr >> DMA_POOL_PUDDLE_SHIFT) & (DMA_POOL_SEG_LEAF - 1)] : NULL;
+}
+
+/* Size class of the class block at @ptr and its puddle, or -1 for anything else
+ * (a header dma_alloc() block).  Needs no lock while the block is live. */
+static LONG dma_pool_block_class(struct dma_pool *pool, APTR ptr, struct dma_puddle **owner)
+{
+	ULONG a = (ULONG)ptr;
+	if (a >= DMA_MEM_2GB)
+		return -1;
+
+	struct dma_puddle **slot = dma_pool_seg_slot(pool, a, FALSE);
+	struct dma_puddle *pud = slot ? *slot : NULL;
+	if (pud == NULL)
+		return -1;
+
+	*owner = pud;
+	return (LONG)pud->classes[(a - (ULONG)pud->arena) >> DMA_POOL_CLASS_MIN_SHIFT] - 1;
+}
+
+static struct dma_puddle *dma_pool_grow(struct dma_pool *pool, ULONG need)
+{
+	ULONG arena_size = need > pool->puddle_size ? need : pool->puddle_size;
+	arena_size = ALIGN_UP(arena_size, MEM_BLOCKSIZE);
+
+	/* Line-aligned arenas let line-multiple dma_alloc_oob() blocks pack with no
+	 * alignment slack at all; a standard puddle is aligned to its size for the
+	 * segment map. */
+	BOOL standard = arena_size == DMA_POOL_PUDDLE_SIZE;
+	ULONG map_size = standard ? arena_size >> DMA_POOL_CLASS_MIN_SHIFT : 0;
+	struct dma_puddle **slot = NULL;
+	APTR src = NULL;
+	APTR arena = dma_mem_arena_alloc_window(pool->ctx, arena_size,
+											standard ? DMA_POOL_PUDDLE_SIZE : DMA_ALIGN_MIN,
+											pool->floor, pool->limit, &src);
+	if (arena == NULL)
+	{
+		Kprintf("[dma_mem] out of Emu68 RAM for %lu-byte DMA arena in %08lx-%08lx\n", arena_size,
+				pool->floor, pool->limit);
+		return NULL;
+	}
+
+	struct dma_puddle *pud = AllocMem(sizeof(*pud) + map_size, MEMF_FAST | MEMF_PUBLIC | MEMF_CLEAR);
+	if (standard && pud)
+		slot = dma_pool_seg_slot(pool, (ULONG)arena, TRUE);
+	if (pud == NULL || (standard && slot == NULL))
+	{
+		if (pud)
+			FreeMem(pud, sizeof(*pud) + map_size);
+		dma_mem_arena_free(src, arena, arena_size);
+		return NULL;
+	}
+
+	pud->src = src;
+	pud->arena = arena;
+	pud->arena_size = arena_size;
+	pud->classes = standard ? (UBYTE *)(pud + 1) : NULL;
+
+	/* Private MemHeader managing this arena via Exec Allocate/Deallocate. */
+	pud->mh.mh_Attributes = MEMF_FAST;
+	pud->mh.mh_First = (struct MemChunk *)arena;
+	pud->mh.mh_Lower = arena;
+	pud->mh.mh_Upper = (APTR)((ULONG)arena + arena_size);
+	pud->mh.mh_Free = arena_size;
+	((struct MemChunk *)arena)->mc_Next = NULL;
+	((struct MemChunk *)arena)->mc_Bytes = arena_size;
+
+	if (slot)
+		*slot = pud;
+	pud->next = pool->puddles;
+	pool->puddles = pud;
+	pool->empty_puddles++;
+	pool->arena_bytes += arena_size;
+	return pud;
+}
+
+/* Cached size-class blocks keep their owning puddle in the word after the free-list
+ * link (every class block is at least 64 bytes). */
+#define DMA_CLASS_NEXT(blk) (((APTR *)(blk))[0])
+#define DMA_CLASS_OWNER(blk) (((APTR *)(blk))[1])
+
+/* Class block @blk of @pud goes back to the puddle's free space. */
+static inline void dma_puddle_uncarve(struct dma_puddle *pud, APTR blk, ULONG need)
+{
+	pud->classes[((ULONG)blk - (ULONG)pud->arena) >> DMA_POOL_CLASS_MIN_SHIFT] = 0;
+	Deallocate(&pud->mh, blk, need);
+}
+
+/* Pull @pud's blocks out of the class caches and back into its free space. */
+static void dma_puddle_evict(struct dma_pool *pool, struct dma_puddle *pud)
+{
+	for (u32 c = 0; c < DMA_POOL_CLASSES && pud->cached; c++)
+	{
+		ULONG need = 1UL << (c + DMA_POOL_CLASS_MIN_SHIFT);
+		APTR *pp = &pool->class_free[c];
+		while (*pp && pud->cached)
+		{
+			APTR blk = *pp;
+			if (DMA_CLASS_OWNER(blk) != pud)
+			{
+				pp = &DMA_CLASS_NEXT(blk);
+				continue;
+			}
+			*pp = DMA_CLASS_NEXT(blk);
+			pool->class_cached[c]--;
+			pud->cached -= need;
+			dma_puddle_uncarve(pud, blk, need);
+		}
+	}
+}
+
+/* Unlink @pud and give its arena back to the Emu68 header it came from. */
+static void dma_pool_release_puddle(struct dma_pool *pool, struct dma_puddle *pud)
+{
+	if (pud->cached)
+		dma_puddle_evict(pool, pud);
+
+	struct dma_puddle **pp = &pool->puddles;
+	while (*pp != pud)
+		pp = &(*pp)->next;
+	*pp = pud->next;
+	pool->empty_puddles--;
+	pool->arena_bytes -= pud->arena_size;
+	if (pud->classes)
+		*dma_pool_seg_slot(pool, (ULONG)pud->arena, FALSE) = NULL;
+
+	KprintfH("[dma_mem] releasing empty %lu-byte DMA arena %08lx\n", pud->arena_size, (ULONG)pud->arena);
+	dma_mem_arena_free(pud->src, pud->arena, pud->arena_size);
+	FreeMem(pud, dma_puddle_meta_size(pud));
+}
+
+/* No live block left: everything is free or parked in the class caches, so cached
+ * blocks never keep a puddle from being released. */
+static inline BOOL dma_puddle_empty(const struct dma_puddle *pud)
+{
+	return pud->mh.mh_Free + pud->cached == pud->arena_size;
+}
+
+/* An empty puddle may go back to Emu68 RAM once the pool has more than its spare
+ * count of them, provided the reserved headroom survives without it. */
+static inline BOOL dma_pool_may_release(const struct dma_pool *pool, const struct dma_puddle *pud)
+{
+	return pool->empty_puddles > pool->spare_puddles &&
+		   pool->arena_bytes - pud->arena_size >= pool->in_use + pool->reserve;
+}
+
+/* @pud has just become empty.  A reserved pool promises its free path never
+ * Forbid()s, so the release waits for dma_pool_refill() or dma_pool_trim(). */
+static void dma_pool_puddle_emptied(struct dma_pool *pool, struct dma_puddle *pud)
+{
+	pool->empty_puddles++;
+	if (!dma_pool_may_release(pool, pud))
+		return;
+	if (pool->reserve)
+		pool->surplus_pending = TRUE;
+	else
+		dma_pool_release_puddle(pool, pud);
+}
+
+/* Release empty puddles down to the spare count, as far as the reserve allows. */
+static void dma_pool_release_surplus(struct dma_pool *pool)
+{
+	struct dma_puddle *pud = pool->puddles;
+	while (pud && pool->empty_puddles > pool->spare_puddles)
+	{
+		struct dma_puddle *next = pud->next;
+		if (dma_puddle_empty(pud) && dma_pool_may_release(pool, pud))
+			dma_pool_release_puddle(pool, pud);
+		pud = next;
+	}
+	pool->surplus_pending = FALSE;
+}
+
+static APTR dma_puddle_alloc(struct dma_pool *pool, struct dma_puddle *pud, ULONG need)
+{
+	BOOL was_empty = dma_puddle_empty(pud);
+	APTR ptr = Allocate(&pud->mh, need);
+	if (ptr && was_empty)
+		pool->empty_puddles--;
+	return ptr;
+}
+
+static void dma_puddle_free(struct dma_pool *pool, struct dma_puddle *pud, APTR ptr, ULONG need)
+{
+	Deallocate(&pud->mh, ptr, need);
+	if (dma_puddle_empty(pud))
+		dma_pool_puddle_emptied(pool, pud);
+}
+
+/* Exactly @need bytes aligned to @align from @pud: try a plain Allocate() first
+ * (line-multiple blocks in a line-aligned arena are already aligned), else
+ * over-allocate and give the head and tail slack straight back. */
+static APTR dma_puddle_alloc_aligned(struct dma_pool *pool, struct dma_puddle *pud, ULONG need, ULONG align)
+{
+	UBYTE *raw = dma_puddle_alloc(pool, pud, need);
+	if (raw == NULL || ((ULONG)raw & (align - 1)) == 0)
+		return raw;
+	Deallocate(&pud->mh, raw, need);
+	if (dma_puddle_empty(pud))
+		pool->empty_puddles++;
+
+	ULONG total = need + align - MEM_BLOCKSIZE;
+	raw = dma_puddle_alloc(pool, pud, total);
+	if (raw == NULL)
+		return NULL;
+
+	UBYTE *aligned = (UBYTE *)ALIGN_UP((ULONG)raw, align);
+	ULONG head = (ULONG)(aligned - raw);
+	ULONG tail = total - head - need;
+	if (head)
+		Deallocate(&pud->mh, raw, head);
+	if (tail)
+		Deallocate(&pud->mh, aligned + need, tail);
+	return aligned;
+}
+
+static struct dma_puddle *dma_pool_find_puddle(struct dma_pool *pool, APTR ptr)
+{
+	ULONG a = (ULONG)ptr;
+
+	for (struct dma_puddle *pud = pool->puddles; pud; pud = pud->next)
+	{
+		if (a >= (ULONG)pud->mh.mh_Lower && a < (ULONG)pud->mh.mh_Upper)
+			return pud;
+	}
+	return NULL;
+}
+
+/* Size class of a MEM_BLOCKSIZE-rounded request that is exactly a class size, or -1
+ * for the MemHeader path. */
+static inline LONG dma_pool_class(ULONG need)
+{
+	if (need < (1UL << DMA_POOL_CLASS_MIN_SHIFT) || need > (1UL << DMA_POOL_CLASS_MAX_SHIFT) ||
+		(need & (need - 1)) != 0)
+		return -1;
+
+	return (LONG)__builtin_ctz((unsigned int)need) - DMA_POOL_CLASS_MIN_SHIFT;
+}
+
+#ifdef MEM_STATS
+static u32 dma_pool_stat_bucket(ULONG size)
+{
+	u32 b = 0;
+	while (b < DMA_STATS_BUCKETS - 1 && size > (16UL << b))
+		b++;
+	return b;
+}
+
+/* Bytes handed out to callers: magazine-resident blocks are still free to them. */
+static void dma_pool_stat_high(struct dma_pool *pool)
+{
+	struct dma_pool_stats *st = &pool->stats;
+
+	if (pool->in_use - st->mag_bytes > st->bytes_high)
+		st->bytes_high = pool->in_use - st->mag_bytes;
+}
+
+static void dma_pool_stat_alloc(struct dma_pool *pool, ULONG size, APTR ptr)
+{
+	struct dma_pool_stats *st = &pool->stats;
+
+	if (ptr == NULL)
+	{
+		st->failures++;
+		return;
+	}
+
+	st->size_hist[dma_pool_stat_bucket(size)]++;
+	st->allocs++;
+	dma_pool_stat_high(pool);
+}
+
+static void dma_pool_stat_free(struct dma_pool *pool)
+{
+	pool->stats.frees++;
+}
+#else
+#define dma_pool_stat_alloc(pool, size, ptr) ((void)0)
+#define dma_pool_stat_free(pool) ((void)0)
+#endif
+
+/* Account @need bytes handed out and, on a reserved pool, flag a refill once the
+ * headroom left in the puddles falls below the low-water mark. */
+static inline void dma_pool_note_alloc(struct dma_pool *pool, ULONG need)
+{
+	pool->in_use += need;
+	if (pool->reserve && pool->arena_bytes - pool->in_use < pool->low_water)
+		pool->refill_pending = TRUE;
+}
+
+static inline void dma_pool_lock(struct dma_pool *pool)
+{
+	if (pool->concurrent)
+		ObtainSemaphore(&pool->lock);
+}
+
+static inline void dma_pool_unlock(struct dma_pool *pool)
+{
+	if (pool->concurrent)
+		ReleaseSemaphore(&pool->lock);
+}
+
+/* A new class-@c block of @need bytes, aligned to its size, from a standard puddle
+ * (growing the pool unless it is reserved). */
+static APTR dma_pool_carve(struct dma_pool *pool, LONG c, ULONG need, APTR *owner)
+{
+	struct dma_puddle *pud;
+	APTR ptr = NULL;
+
+	for (pud = pool->puddles; pud; pud = pud->next)
+	{
+		if (pud->classes && (ptr = dma_puddle_alloc_aligned(pool, pud, need, need)) != NULL)
+			break;
+	}
+
+	if (ptr == NULL)
+	{
+		pud = pool->reserve ? NULL : dma_pool_grow(pool, need);
+		if (pud)
+			ptr = dma_puddle_alloc_aligned(pool, pud, need, need);
+		else if (pool->reserve)
+			pool->refill_pending = TRUE;
+	}
+
+	if (ptr)
+	{
+		pud->classes[((ULONG)ptr - (ULONG)pud->arena) >> DMA_POOL_CLASS_MIN_SHIFT] = (UBYTE)(c + 1);
+		*owner = pud;
+	}
+	return ptr;
+}
+
+/* A block of @size bytes off the pool's free space, without counting it in the
+ * statistics (the magazines count their own hand-outs). */
+static APTR dma_pool_take_unlocked(struct dma_pool *pool, ULONG size, APTR *owner)
+{
+	ULONG need = ALIGN_UP(size, MEM_BLOCKSIZE);
+	APTR ptr = NULL;
+
+	LONG c = dma_pool_class(need);
+	if (c >= 0)
+	{
+		ptr = pool->class_free[c];
+		if (likely(ptr))
+		{
+			struct dma_puddle *pud = DMA_CLASS_OWNER(ptr);
+			pool->class_free[c] = DMA_CLASS_NEXT(ptr);
+			pool->class_cached[c]--;
+			if (dma_puddle_empty(pud))
+				pool->empty_puddles--;
+			pud->cached -= need;
+			*owner = pud;
+		}
+		else
+			ptr = dma_pool_carve(pool, c, need, owner);
+		if (ptr)
+			dma_pool_note_alloc(pool, need);
+		return ptr;
+	}
+
+	for (struct dma_puddle *pud = pool->puddles; pud; pud = pud->next)
+	{
+		ptr = dma_puddle_alloc(pool, pud, need);
+		if (ptr)
+		{
+			*owner = pud;
+			dma_pool_note_alloc(pool, need);
+			return ptr;
+		}
+	}
+
+	/* A reserved pool never grows here (that would Forbid() in the I/O path): the
+	 * caller gets NULL and the refill is left to dma_pool_refill(). */
+	struct dma_puddle *pud = pool->reserve ? NULL : dma_pool_grow(pool, need);
+	if (pud)
+	{
+		*owner = pud;
+		ptr = dma_puddle_alloc(pool, pud, need);
+		if (ptr)
+			dma_pool_note_alloc(pool, need);
+	}
+	else if (pool->reserve)
+		pool->refill_pending = TRUE;
+	return ptr;
+}
+
+static APTR dma_pool_alloc_unlocked(struct dma_pool *pool, ULONG size, APTR *owner)
+{
+	APTR ptr = dma_pool_take_unlocked(pool, size, owner);
+	dma_pool_stat_alloc(pool, size, ptr);
+	return ptr;
+}
+
+/* Give a block back to the pool's free space; FALSE if it is not the pool's.  Like
+ * dma_pool_take_unlocked(), leaves the statistics alone. */
+static BOOL dma_pool_put_unlocked(struct dma_pool *pool, APTR ptr, ULONG size, APTR owner)
+{
+	ULONG need = ALIGN_UP(size, MEM_BLOCKSIZE);
+
+	LONG c = dma_pool_class(need);
+	struct dma_puddle *pud = owner ? (struct dma_puddle *)owner : dma_pool_find_puddle(pool, ptr);
+	if (pud == NULL)
+	{
+		Kprintf("[dma_mem] region_free: %08lx not from this pool\n", (ULONG)ptr);
+		return FALSE;
+	}
+	pool->in_use -= need;
+
+	if (c >= 0 && pool->class_cached[c] < (DMA_POOL_CLASS_CACHE_BYTES >> (c + DMA_POOL_CLASS_MIN_SHIFT)))
+	{
+		DMA_CLASS_NEXT(ptr) = pool->class_free[c];
+		DMA_CLASS_OWNER(ptr) = pud;
+		pool->class_free[c] = ptr;
+		pool->class_cached[c]++;
+		pud->cached += need;
+		if (dma_puddle_empty(pud))
+			dma_pool_puddle_emptied(pool, pud);
+		return TRUE;
+	}
+
+	if (c >= 0)
+		pud->classes[((ULONG)ptr - (ULONG)pud->arena) >> DMA_POOL_CLASS_MIN_SHIFT] = 0;
+	dma_puddle_free(pool, pud, ptr, need);
+	return TRUE;
+}
+
+static void dma_pool_free_unlocked(struct dma_pool *pool, APTR ptr, ULONG size, APTR owner)
+{
+	if (dma_pool_put_unlocked(pool, ptr, size, owner))
+		dma_pool_stat_free(pool);
+}
+
+APTR dma_pool_region_alloc_owned(struct dma_pool *pool, ULONG size, APTR *owner)
+{
+	dma_pool_lock(pool);
+	APTR ptr = dma_pool_alloc_unlocked(pool, size, owner);
+	dma_pool_unlock(pool);
+	return ptr;
+}
+
+void dma_pool_region_free_owned(struct dma_pool *pool, APTR ptr, ULONG size, APTR owner)
+{
+	if (ptr == NULL)
+		return;
+
+	dma_track_check_free(pool, ptr, size);
+	dma_pool_lock(pool);
+	dma_pool_free_unlocked(pool, ptr, size, owner);
+	dma_pool_unlock(pool);
+}
+
+void dma_free(struct dma_pool *pool, void *ptr)
+{
+	struct dma_puddle *pud;
+
+	if (ptr == NULL)
+		return;
+
+	LONG c = dma_pool_block_class(pool, ptr, &pud);
+	if (c >= 0)
+	{
+		dma_pool_region_free_owned(pool, ptr, 1UL << (c + DMA_POOL_CLASS_MIN_SHIFT), pud);
+		return;
+	}
+
+	struct dma_alloc_hdr *raw = ((struct dma_alloc_hdr **)ptr)[-1];
+	dma_pool_region_free_owned(pool, raw, raw->total, raw->owner);
+}
+
+APTR dma_pool_region_alloc(struct dma_pool *pool, ULONG size)
+{
+	APTR owner;
+	return dma_pool_region_alloc_owned(pool, size, &owner);
+}
+
+void dma_pool_region_free(struct dma_pool *pool, APTR ptr, ULONG size)
+{
+	dma_pool_region_free_owned(pool, ptr, size, NULL);
+}
+
+/* --- Out-of-band allocations ------------------------------------------------- */
+
+static inline ULONG dma_oob_hash(const struct dma_pool *pool, ULONG addr)
+{
+	/* Multiplicative hash; fold the well-mixed high half down since the low bits
+	 * of a line-aligned address are all zero. */
+	u32 h = (u32)addr * 2654435761U;
+	return (h ^ (h >> 16)) & (pool->oob_slots - 1);
+}
+
+static void dma_oob_insert(struct dma_pool *pool, ULONG addr, ULONG size, struct dma_puddle *owner)
+{
+	ULONG i = dma_oob_hash(pool, addr);
+	while (pool->oob[i].addr)
+		i = (i + 1) & (pool->oob_slots - 1);
+
+	pool->oob[i].addr = addr;
+	pool->oob[i].size = size;
+	pool->oob[i].owner = owner;
+	pool->oob_count++;
+}
+
+/* Make room for one more entry, doubling the table at half load. */
+static BOOL dma_oob_reserve(struct dma_pool *pool)
+{
+	if ((pool->oob_count + 1) * 2 <= pool->oob_slots)
+		return TRUE;
+
+	ULONG old_slots = pool->oob_slots;
+	struct dma_oob_ent *old = pool->oob;
+	ULONG slots = old_slots ? old_slots * 2 : DMA_OOB_MIN_SLOTS;
+
+	struct dma_oob_ent *tab = AllocMem(slots * sizeof(*tab), MEMF_FAST | MEMF_PUBLIC | MEMF_CLEAR);
+	if (tab == NULL)
+		return FALSE;
+
+	pool->oob = tab;
+	pool->oob_slots = slots;
+	pool->oob_count = 0;
+	for (ULONG i = 0; i < old_slots; i++)
+	{
+		if (old[i].addr)
+			dma_oob_insert(pool, old[i].addr, old[i].size, old[i].owner);
+	}
+	if (old)
+		FreeMem(old, old_slots * sizeof(*old));
+	return TRUE;
+}
+
+/* Find and remove @addr's entry (backward-shift delete keeps probe chains intact
+ * without tombstones).  Returns FALSE if @addr was not allocated here. */
+static BOOL dma_oob_remove(struct dma_pool *pool, ULONG addr, struct dma_oob_ent *out)
+{
+	if (pool->oob_slots == 0)
+		return FALSE;
+
+	ULONG mask = pool->oob_slots - 1;
+	ULONG i = dma_oob_hash(pool, addr);
+	while (pool->oob[i].addr != addr)
+	{
+		if (pool->oob[i].addr == 0)
+			return FALSE;
+		i = (i + 1) & mask;
+	}
+	*out = pool->oob[i];
+
+	ULONG j = i;
+	for (;;)
+	{
+		j = (j + 1) & mask;
+		if (pool->oob[j].addr == 0)
+			break;
+		/* Move entry j into the hole unless its home slot lies cyclically in (i, j]. */
+		ULONG home = dma_oob_hash(pool, pool->oob[j].addr);
+		if (((j - home) & mask) >= ((j - i) & mask))
+		{
+			pool->oob[i] = pool->oob[j];
+			i = j;
+		}
+	}
+	pool->oob[i].addr = 0;
+	pool->oob_count--;
+	return TRUE;
+}
+
+void *dma_alloc_oob(struct dma_pool *pool, ULONG align, ULONG size)
+{
+	if (size == 0)
+		return NULL;
+
+	if (align < MEM_BLOCKSIZE)
+		align = MEM_BLOCKSIZE;
+	if (align >= DMA_ALIGN_MIN)
+		size = ALIGN_UP(size, align);
+	ULONG need = ALIGN_UP(size, MEM_BLOCKSIZE);
+
+	dma_pool_lock(pool);
+	APTR ptr = NULL;
+	struct dma_puddle *pud = NULL;
+
+	if (dma_oob_reserve(pool))
+	{
+		for (pud = pool->puddles; pud; pud = pud->next)
+		{
+			ptr = dma_puddle_alloc_aligned(pool, pud, need, align);
+			if (ptr)
+				break;
+		}
+
+		if (ptr == NULL && pool->reserve == 0)
+		{
+			pud = dma_pool_grow(pool, need + align);
+			if (pud)
+				ptr = dma_puddle_alloc_aligned(pool, pud, need, align);
+		}
+		else if (ptr == NULL)
+			pool->refill_pending = TRUE;
+	}
+
+	if (ptr)
+	{
+		dma_oob_insert(pool, (ULONG)ptr, need, pud);
+		dma_pool_note_alloc(pool, need);
+	}
+	dma_pool_stat_alloc(pool, size, ptr);
+	dma_pool_unlock(pool);
+	return ptr;
+}
+
+void dma_free_oob(struct dma_pool *pool, void *ptr)
+{
+	if (ptr == NULL)
+		return;
+
+	dma_pool_lock(pool);
+	struct dma_oob_ent ent;
+	if (!dma_oob_remove(pool, (ULONG)ptr, &ent))
+	{
+		dma_pool_unlock(pool);
+		Kprintf("[dma_mem] dma_free_oob: %08lx not from this pool\n", (ULONG)ptr);
+		return;
+	}
+
+	dma_track_check_free(pool, ptr, ent.size);
+	pool->in_use -= ent.size;
+	dma_pool_stat_free(pool);
+	dma_puddle_free(pool, ent.owner, ptr, ent.size);
+	dma_pool_unlock(pool);
+}
+
+/* --- Per-task magazines ------------------------------------------------------ */
+
+void dma_pool_enable_concurrent(struct dma_pool *pool)
+{
+	if (pool == NULL || pool->concurrent)
+		return;
+
+	InitSemaphore(&pool->lock);
+	pool->concurrent = TRUE;
+}
+
+void dma_pool_cache_init(struct dma_pool_cache *cache, struct dma_pool *pool)
+{
+	cache->pool = pool;
+	for (u32 c = 0; c < DMA_POOL_CACHE_CLASSES; c++)
+	{
+		cache->count[c] = 0;
+#ifdef MEM_STATS
+		cache->allocs[c] = 0;
+		cache->frees[c] = 0;
+#endif
+	}
+}
+
+#ifdef MEM_STATS
+/* Fold @cache's lock-free hand-outs and returns into the pool's statistics; called
+ * under the lock.  Blocks move between the magazine and the caller with them. */
+static void dma_pool_cache_stat_fold(struct dma_pool_cache *cache)
+{
+	struct dma_pool_stats *st = &cache->pool->stats;
+
+	for (u32 c = 0; c < DMA_POOL_CACHE_CLASSES; c++)
+	{
+		ULONG size = 1UL << (c + DMA_POOL_CLASS_MIN_SHIFT);
+		st->allocs += cache->allocs[c];
+		st->frees += cache->frees[c];
+		st->size_hist[dma_pool_stat_bucket(size)] += cache->allocs[c];
+		st->mag_bytes += cache->frees[c] * size;
+		st->mag_bytes -= cache->allocs[c] * size;
+		cache->allocs[c] = 0;
+		cache->frees[c] = 0;
+	}
+	dma_pool_stat_high(cache->pool);
+}
+
+#define dma_pool_cache_stat(cache, what, c) ((cache)->what[c]++)
+#define dma_pool_stat_mag(pool, bytes) ((pool)->stats.mag_bytes += (bytes))
+#else
+#define dma_pool_cache_stat_fold(cache) ((void)0)
+#define dma_pool_cache_stat(cache, what, c) ((void)0)
+#define dma_pool_stat_mag(pool, bytes) ((void)0)
+#endif
+
+/* Return the oldest @n blocks of class @c's magazine to the depot (one lock). */
+static void dma_pool_cache_drain(struct dma_pool_cache *cache, u32 c, ULONG n)
+{
+	struct dma_pool *pool = cache->pool;
+	ULONG size = 1UL << (c + DMA_POOL_CLASS_MIN_SHIFT);
+	APTR *mag = cache->mag[c];
+
+	dma_pool_lock(pool);
+	dma_pool_cache_stat_fold(cache);
+	for (ULONG i = 0; i < n; i++)
+	{
+		if (dma_pool_put_unlocked(pool, mag[i], size, DMA_CLASS_OWNER(mag[i])))
+			dma_pool_stat_mag(pool, -size);
+	}
+	dma_pool_unlock(pool);
+
+	for (ULONG i = n; i < cache->count[c]; i++)
+		mag[i - n] = mag[i];
+	cache->count[c] -= n;
+}
+
+void dma_pool_cache_flush(struct dma_pool_cache *cache)
+{
+	for (u32 c = 0; c < DMA_POOL_CACHE_CLASSES; c++)
+	{
+		if (cache->count[c])
+			dma_pool_cache_drain(cache, c, cache->count[c]);
+	}
+}
+
+APTR dma_pool_cache_region_alloc(struct dma_pool_cache *cache, ULONG size, APTR *owner)
+{
+	struct dma_pool *pool = cache->pool;
+	LONG c = dma_pool_class(ALIGN_UP(size, MEM_BLOCKSIZE));
+	if (c < 0)
+		return dma_pool_region_alloc_owned(pool, size, owner);
+
+	APTR *mag = cache->mag[c];
+	if (likely(cache->count[c]))
+	{
+		APTR ptr = mag[--cache->count[c]];
+		*owner = DMA_CLASS_OWNER(ptr);
+		dma_pool_cache_stat(cache, allocs, c);
+		return ptr;
+	}
+
+	/* Empty magazine: refill half of it from the depot under one lock, so the next
+	 * few allocations are lock-free again.  The refill is not an allocation: the
+	 * blocks count once handed out. */
+	ULONG need = 1UL << (c + DMA_POOL_CLASS_MIN_SHIFT);
+	dma_pool_lock(pool);
+	dma_pool_cache_stat_fold(cache);
+	while (cache->count[c] < DMA_POOL_MAG_SIZE / 2)
+	{
+		APTR blk_owner;
+		APTR blk = dma_pool_take_unlocked(pool, need, &blk_owner);
+		if (blk == NULL)
+			break;
+		DMA_CLASS_OWNER(blk) = blk_owner;
+		mag[cache->count[c]++] = blk;
+		dma_pool_stat_mag(pool, need);
+	}
+	if (cache->count[c] == 0)
+		dma_pool_stat_alloc(pool, need, NULL);
+	dma_pool_unlock(pool);
+
+	if (cache->count[c] == 0)
+		return NULL;
+
+	APTR ptr = mag[--cache->count[c]];
+	*owner = DMA_CLASS_OWNER(ptr);
+	dma_pool_cache_stat(cache, allocs, c);
+	return ptr;
+}
+
+void dma_pool_cache_region_free(struct dma_pool_cache *cache, APTR ptr, ULONG size, APTR owner)
+{
+	if (ptr == NULL)
+		return;
+
+	LONG c = dma_pool_class(ALIGN_UP(size, MEM_BLOCKSIZE));
+	if (c < 0)
+	{
+		dma_pool_region_free_owned(cache->pool, ptr, size, owner);
+		return;
+	}
+
+	dma_track_check_free(cache->pool, ptr, size);
+
+	/* Full magazine: hand its older half to the depot first. */
+	if (unlikely(cache->count[c] == DMA_POOL_MAG_SIZE))
+		dma_pool_cache_drain(cache, (u32)c, DMA_POOL_MAG_SIZE / 2);
+
+	DMA_CLASS_OWNER(ptr) = owner;
+	cache->mag[c][cache->count[c]++] = ptr;
+	dma_pool_cache_stat(cache, frees, c);
+}
+
+void dma_cache_free(struct dma_pool_cache *cache, void *ptr)
+{
+	struct dma_puddle *pud;
+
+	if (ptr == NULL)
+		return;
+
+	LONG c = dma_pool_block_class(cache->pool, ptr, &pud);
+	if (c >= 0)
+	{
+		dma_pool_cache_region_free(cache, ptr, 1UL << (c + DMA_POOL_CLASS_MIN_SHIFT), pud);
+		return;
+	}
+
+	struct dma_alloc_hdr *raw = ((struct dma_alloc_hdr **)ptr)[-1];
+	dma_pool_region_free_owned(cache->pool, raw, raw->total, raw->owner);
+}
+
+void dma_pool_trim(struct dma_pool *pool)
+{
+	if (pool == NULL)
+		return;
+
+	/* Hand every cached size-class block back to its puddle.  A puddle's emptiness
+	 * already counts cached blocks as free, so nothing changes state here. */
+	dma_pool_lock(pool);
+	for (u32 c = 0; c < DMA_POOL_CLASSES; c++)
+	{
+		ULONG need = 1UL << (c + DMA_POOL_CLASS_MIN_SHIFT);
+		APTR blk = pool->class_free[c];
+		pool->class_free[c] = NULL;
+		pool->class_cached[c] = 0;
+		while (blk)
+		{
+			APTR next = DMA_CLASS_NEXT(blk);
+			struct dma_puddle *pud = DMA_CLASS_OWNER(blk);
+			pud->cached -= need;
+			dma_puddle_uncarve(pud, blk, need);
+			blk = next;
+		}
+	}
+	dma_pool_release_surplus(pool);
+	dma_pool_unlock(pool);
+}
+
+void dma_pool_set_spare(struct dma_pool *pool, ULONG spare)
+{
+	if (pool == NULL)
+		return;
+
+	dma_pool_lock(pool);
+	pool->spare_puddles = spare;
+	dma_pool_release_surplus(pool);
+	dma_pool_unlock(pool);
+}
+
+ULONG dma_pool_refill(struct dma_pool *pool)
+{
+	if (pool == NULL)
+		return 0;
+
+	dma_pool_lock(pool);
+	if (pool->surplus_pending)
+		dma_pool_release_surplus(pool);
+	ULONG before = pool->arena_bytes;
+	while (pool->arena_bytes - pool->in_use < pool->reserve)
+	{
+		if (dma_pool_grow(pool, pool->puddle_size) == NULL)
+			break;
+	}
+	pool->refill_pending = pool->arena_bytes - pool->in_use < pool->low_water;
+	ULONG added = pool->arena_bytes - before;
+	dma_pool_unlock(pool);
+	return added;
+}
+
+BOOL dma_pool_refill_pending(struct dma_pool *pool)
+{
+	return pool && (pool->refill_pending || pool->surplus_pending);
+}
+
+BOOL dma_pool_reserve(struct dma_pool *pool, ULONG bytes, ULONG low_water)
+{
+	if (pool == NULL)
+		return FALSE;
+
+	/* The semaphore nests, so the whole update is one step for other tasks. */
+	dma_pool_lock(pool);
+	pool->reserve = bytes;
+	pool->low_water = low_water ? low_water : bytes / 4;
+	if (pool->low_water > bytes)
+		pool->low_water = bytes;
+
+	if (bytes == 0)
+	{
+		pool->refill_pending = FALSE;
+		dma_pool_set_spare(pool, pool->spare_puddles);
+		dma_pool_unlock(pool);
+		return TRUE;
+	}
+
+	dma_pool_refill(pool);
+	ULONG headroom = pool->arena_bytes - pool->in_use;
+	dma_pool_unlock(pool);
+
+	if (headroom < bytes)
+	{
+		Kprintf("[dma_mem] could only reserve %lu of %lu bytes of Emu68 RAM\n", headroom, bytes);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+struct dma_pool *dma_pool_create_limited(struct dma_mem_ctx *ctx, ULONG floor, ULONG limit)
+{
+	if (ctx == NULL || ctx->count == 0 || floor > limit)
+		return NULL;
+
+	const struct dma_mem_region *regions = dma_mem_regions(ctx);
+	BOOL any = FALSE;
+	for (u32 i = 0; i < ctx->count; i++)
+	{
+		if (regions[i].end - 1 >= floor && regions[i].start <= limit)
+			any = TRUE;
+	}
+	if (!any)
+	{
+		Kprintf("[dma_mem] no Emu68 RAM in %08lx-%08lx\n", floor, limit);
+		return NULL;
+	}
+
+	struct dma_pool *pool = AllocMem(sizeof(*pool), MEMF_FAST | MEMF_PUBLIC | MEMF_CLEAR);
+	if (pool == NULL)
+		return NULL;
+
+	pool->ctx = ctx;
+	pool->puddles = NULL;
+	pool->puddle_size = DMA_POOL_PUDDLE_SIZE;
+	pool->empty_puddles = 0;
+	pool->spare_puddles = DMA_POOL_SPARE_PUDDLES;
+	pool->floor = floor;
+	pool->limit = limit;
+	pool->arena_bytes = 0;
+	pool->in_use = 0;
+	pool->reserve = 0;
+	pool->low_water = 0;
+	pool->refill_pending = FALSE;
+	pool->surplus_pending = FALSE;
+	pool->bounce_free = NULL;
+	pool->bounce_slot_size = 0;
+	for (u32 i = 0; i < DMA_POOL_CLASSES; i++)
+	{
+		pool->class_free[i] = NULL;
+		pool->class_cached[i] = 0;
+	}
+	pool->oob = NULL;
+	pool->oob_slots = 0;
+	pool->oob_count = 0;
+	pool->concurrent = FALSE;
+	return pool;
+}
+
+struct dma_pool *dma_pool_create(struct dma_mem_ctx *ctx)
+{
+	return dma_pool_create_limited(ctx, 0, DMA_MEM_LIMIT_NONE);
+}
+
+void dma_pool_delete(struct dma_pool *pool)
+{
+	if (pool == NULL)
+		return;
+
+	struct dma_puddle *pud = pool->puddles;
+	while (pud)
+	{
+		struct dma_puddle *next = pud->next;
+		dma_mem_arena_free(pud->src, pud->arena, pud->arena_size);
+		FreeMem(pud, dma_puddle_meta_size(pud));
+		pud = next;
+	}
+	for (ULONG i = 0; i < DMA_MEM_LOOKUP_SLOTS; i++)
+	{
+		if (pool->seg[i])
+			FreeMem(pool->seg[i], DMA_POOL_SEG_LEAF * sizeof(*pool->seg[i]));
+	}
+	if (pool->oob)
+		FreeMem(pool->oob, pool->oob_slots * sizeof(*pool->oob));
+	FreeMem(pool, sizeof(*pool));
+}
+
+/* --- Bounce engine ----------------------------------------------------------- */
+
+BOOL dma_pool_bounce_init(struct dma_pool *pool, ULONG slot_count, ULONG slot_size)
+{
+	if (pool == NULL || slot_count == 0 || slot_size == 0 || pool->bounce_slot_size)
+		return FALSE;
+
+	slot_size = ALIGN_UP(slot_size, DMA_ALIGN_MIN);
+
+	/* One contiguous block, carved now so dma_map() never allocates; it lives in a
+	 * puddle and goes away with the pool in dma_pool_delete(). */
+	UBYTE *mem = dma_alloc(pool, DMA_ALIGN_MIN, slot_count * slot_size);
+	if (mem == NULL)
+	{
+		Kprintf("[dma_mem] no Emu68 RAM for %lu x %lu bounce slots\n", slot_count, slot_size);
+		return FALSE;
+	}
+
+	APTR head = NULL;
+	for (ULONG i = slot_count; i > 0; i--)
+	{
+		APTR slot = mem + (i - 1) * slot_size;
+		*(APTR *)slot = head;
+		head = slot;
+	}
+
+	dma_pool_lock(pool);
+	pool->bounce_free = head;
+	pool->bounce_slot_size = slot_size;
+	dma_pool_unlock(pool);
+	return TRUE;
+}
+
+BOOL dma_map(struct dma_pool *pool, struct dma_map *map, APTR buf, ULONG len, ULONG dir)
+{
+	map->buf = buf;
+	map->dma = buf;
+	map->len = len;
+	map->dir = dir;
+	map->slot = NULL;
+
+	/* A device write invalidates whole cache lines, so an in-place buffer must not
+	 * share its first/last line with anything else. */
+	BOOL whole_lines = (((ULONG)buf | len) & DMA_ALIGN_MIN_MASK) == 0;
+
+	/* On a limited pool the buffer must also sit in the pool's window; the bounce
+	 * slots always do. */
+	BOOL in_window = (ULONG)buf >= pool->floor && (ULONG)buf + (len - 1) <= pool->limit;
+
+	if (len == 0 || (in_window && dma_addr_reachable(pool->ctx, buf, len) &&
+					 ((dir & DMA_FROM_DEVICE) == 0 || whole_lines)))
+	{
+		dma_track_give(pool, buf, len, dir, TRUE, "dma_map");
+		return TRUE;
+	}
+
+	if (unlikely(len > pool->bounce_slot_size))
+		return FALSE;
+
+	dma_pool_lock(pool);
+	APTR slot = pool->bounce_free;
+	if (likely(slot != NULL))
+		pool->bounce_free = *(APTR *)slot;
+	dma_pool_unlock(pool);
+	if (unlikely(slot == NULL))
+		return FALSE;
+
+	if (dir & DMA_TO_DEVICE)
+		memcpy(slot, buf, len);
+
+	map->dma = slot;
+	map->slot = slot;
+	dma_track_give(pool, slot, len, dir, TRUE, "dma_map");
+	return TRUE;
+}
+
+void dma_unmap(struct dma_pool *pool, struct dma_map *map)
+{
+	dma_track_take(pool, map->dma, map->len, TRUE, "dma_unmap");
+
+	APTR slot = map->slot;
+	if (slot == NULL)
+		return;
+
+	if (map->dir & DMA_FROM_DEVICE)
+		memcpy(map->buf, slot, map->len);
+
+	dma_pool_lock(pool);
+	*(APTR *)slot = pool->bounce_free;
+	pool->bounce_free = slot;
+	dma_pool_unlock(pool);
+	map->slot = NULL;
+	map->dma = map->buf;
+}
+
+/* --- Cache sync -------------------------------------------------------------- */
+
+ULONG dma_sync_coalesce(struct dma_sync_range *ranges, ULONG count)
+{
+	/* Widen to whole lines and drop empty ranges.  @len temporarily holds the end
+	 * address so the merge below compares like with like. */
+	ULONG n = 0;
+	for (ULONG i = 0; i < count; i++)
+	{
+		if (ranges[i].len == 0)
+			continue;
+		ULONG start = (ULONG)ranges[i].addr & ~(ULONG)DMA_ALIGN_MIN_MASK;
+		ULONG end = ALIGN_UP((ULONG)ranges[i].addr + ranges[i].len, DMA_ALIGN_MIN);
+		ranges[n].addr = (APTR)start;
+		ranges[n].len = end;
+		n++;
+	}
+
+	/* Insertion sort by start: batches are ring-sized and usually already in
+	 * address order, where this is a single pass. */
+	for (ULONG i = 1; i < n; i++)
+	{
+		struct dma_sync_range r = ranges[i];
+		ULONG j = i;
+		while (j > 0 && (ULONG)ranges[j - 1].addr > (ULONG)r.addr)
+		{
+			ranges[j] = ranges[j - 1];
+			j--;
+		}
+		ranges[j] = r;
+	}
+
+	ULONG out = 0;
+	for (ULONG i = 0; i < n; i++)
+	{
+		if (out && (ULONG)ranges[i].addr <= ranges[out - 1].len)
+		{
+			if (ranges[i].len > ranges[out - 1].len)
+				ranges[out - 1].len = ranges[i].len;
+		}
+		else
+			ranges[out++] = ranges[i];
+	}
+
+	for (ULONG i = 0; i < out; i++)
+		ranges[i].len -= (ULONG)ranges[i].addr;
+	/* Empty the tail, so the array can be passed again with the same count. */
+	for (ULONG i = out; i < count; i++)
+		ranges[i].len = 0;
+
+	return out;
+}
+
+void dma_sync_for_device(struct dma_pool *pool, APTR addr, ULONG len, ULONG dir)
+{
+	if (len == 0)
+		return;
+
+	dma_track_give(pool, addr, len, dir, FALSE, "dma_sync_for_device");
+
+	ULONG start = (ULONG)addr & ~(ULONG)DMA_ALIGN_MIN_MASK;
+	ULONG span = ALIGN_UP((ULONG)addr + len, DMA_ALIGN_MIN) - start;
+	CachePreDMA((APTR)start, &span, (dir & DMA_TO_DEVICE) ? DMA_ReadFromRAM : 0);
+}
+
+void dma_sync_for_cpu(struct dma_pool *pool, APTR addr, ULONG len, ULONG dir)
+{
+	dma_track_take(pool, addr, len, FALSE, "dma_sync_for_cpu");
+
+	if (len == 0 || (dir & DMA_FROM_DEVICE) == 0)
+		return;
+
+	ULONG start = (ULONG)addr & ~(ULONG)DMA_ALIGN_MIN_MASK;
+	ULONG span = ALIGN_UP((ULONG)addr + len, DMA_ALIGN_MIN) - start;
+	CachePostDMA((APTR)start, &span, 0);
+}
+
+void dma_sync_for_device_batch(struct dma_pool *pool, struct dma_sync_range *ranges, ULONG count,
+							   ULONG dir)
+{
+#ifdef DMA_TRACK
+	/* Record the buffers as given, before coalescing rewrites @ranges in place; a
+	 * take-back with the coalesced array contains each of them. */
+	for (ULONG i = 0; i < count; i++)
+		dma_track_give(pool, ranges[i].addr, ranges[i].len, dir, FALSE,
+					   "dma_sync_for_device_batch");
+#else
+	(void)pool;
+#endif
+
+	ULONG n = dma_sync_coalesce(ranges, count);
+	ULONG flags = (dir & DMA_TO_DEVICE) ? DMA_ReadFromRAM : 0;
+
+	for (ULONG i = 0; i < n; i++)
+	{
+		ULONG span = ranges[i].len;
+		CachePreDMA(ranges[i].addr, &span, flags);
+	}
+}
+
+void dma_sync_for_cpu_batch(struct dma_pool *pool, struct dma_sync_range *ranges, ULONG count,
+							ULONG dir)
+{
+#ifdef DMA_TRACK
+	for (ULONG i = 0; i < count; i++)
+		dma_track_take(pool, ranges[i].addr, ranges[i].len, FALSE, "dma_sync_for_cpu_batch");
+#else
+	(void)pool;
+#endif
+
+	if ((dir & DMA_FROM_DEVICE) == 0)
+		return;
+
+	ULONG n = dma_sync_coalesce(ranges, count);
+	for (ULONG i = 0; i < n; i++)
+	{
+		ULONG span = ranges[i].len;
+		CachePostDMA(ranges[i].addr, &span, 0);
+	}
+}
+
+/* --- Statistics -------------------------------------------------------------- */
+
+#ifdef MEM_STATS
+/* Largest free chunk in a puddle's private MemHeader (what the next non-class
+ * request can get without growing). */
+static ULONG dma_puddle_largest_free(const struct dma_puddle *pud)
+{
+	ULONG largest = 0;
+
+	for (const struct MemChunk *mc = pud->mh.mh_First; mc; mc = mc->mc_Next)
+	{
+		if (mc->mc_Bytes > largest)
+			largest = mc->mc_Bytes;
+	}
+	return largest;
+}
+
+void dma_pool_stats_dump(struct dma_pool *pool, CONST_STRPTR name)
+{
+	if (pool == NULL)
+		return;
+
+	const struct dma_pool_stats *st = &pool->stats;
+	Kprintf("[%s] dma_pool: %lu allocs, %lu frees, %lu failed; %lu bytes in use (high %lu)\n",
+			name, st->allocs, st->frees, st->failures, pool->in_use - st->mag_bytes, st->bytes_high);
+	if (st->mag_bytes)
+		Kprintf("[%s]   %lu bytes in task magazines\n", name, st->mag_bytes);
+
+	for (u32 b = 0; b < DMA_STATS_BUCKETS; b++)
+	{
+		if (st->size_hist[b] == 0)
+			continue;
+		if (b == DMA_STATS_BUCKETS - 1)
+			Kprintf("[%s]   size > %lu: %lu\n", name, 8UL << b, st->size_hist[b]);
+		else
+			Kprintf("[%s]   size <= %lu: %lu\n", name, 16UL << b, st->size_hist[b]);
+	}
+
+	for (u32 c = 0; c < DMA_POOL_CLASSES; c++)
+	{
+		if (pool->class_cached[c])
+			Kprintf("[%s]   class %lu: %lu cached\n", name,
+					1UL << (c + DMA_POOL_CLASS_MIN_SHIFT), pool->class_cached[c]);
+	}
+
+	ULONG count = 0;
+	ULONG arena_bytes = 0;
+	for (const struct dma_puddle *pud = pool->puddles; pud; pud = pud->next)
+	{
+		Kprintf("[%s]   puddle %08lx: %lu bytes, %lu free, largest free chunk %lu\n",
+				name, (ULONG)pud->arena, pud->arena_size, pud->mh.mh_Free,
+				dma_puddle_largest_free(pud));
+		count++;
+		arena_bytes += pud->arena_size;
+	}
+	Kprintf("[%s] dma_pool: %lu puddle(s), %lu empty, %lu bytes of Emu68 RAM held\n",
+			name, count, pool->empty_puddles, arena_bytes);
+}
+#endif
@@ -0,0 +1,117 @@
+// SPDX-License-Identifier: MPL-2.0 OR GPL-2.0+
+/*
+ * dma_ring.c — producer/consumer descriptor rings over dma_pool memory.
+ *             See dma_ring.h for the interface.
+ */
+
+#ifdef __INTELLISENSE__
+#include <clib/exec_protos.h>
+#else
+#define __NOLIBBASE__
+#define EXEC_BASE_NAME (*(struct ExecBase **)4UL)
+#include <proto/exec.h>
+#endif
+
+#include <dma_ring.h>
+#include <bits.h>
+#include <debug.h>
+
+/* Cache-maintain descriptors [from, from + n) (free-running indices): flush them for
+ * the device (@to_device) or invalidate them for the CPU.  A span that wraps is two
+ * runs, which the batch sync merges back into one when they touch.  Descriptors
+ * are shared with the device for the ring's whole life, so they are not given to the
+ * ownership tracker (NULL pool). */
+static void dma_ring_sync(struct dma_ring *ring, ULONG from, ULONG n, BOOL to_device)
+{
+	struct dma_sync_range runs[2];
+	ULONG count = 0;
+
+	while (n)
+	{
+		ULONG idx = from & ring->mask;
+		ULONG run = ring->count - idx;
+		if (run > n)
+			run = n;
+
+		runs[count].addr = ring->desc + idx * ring->elem_size;
+		runs[count].len = run * ring->elem_size;
+		count++;
+
+		from += run;
+		n -= run;
+	}
+
+	if (to_device)
+		dma_sync_for_device_batch(NULL, runs, count, DMA_TO_DEVICE);
+	else
+		dma_sync_for_cpu_batch(NULL, runs, count, DMA_FROM_DEVICE);
+}
+
+BOOL dma_ring_init(struct dma_ring *ring, struct dma_pool *pool, ULONG elem_size, ULONG count,
+				   ULONG align)
+{
+	ring->desc = NULL;
+
+	if (pool == NULL || elem_size == 0 || count < 2 || (count & (count - 1)))
+		return FALSE;
+
+	if (align < DMA_ALIGN_MIN)
+		align = DMA_ALIGN_MIN;
+
+	/* dma_zalloc() rounds the size up to @align, so the ring owns its last line too. */
+	ring->desc = dma_zalloc(pool, align, elem_size * count);
+	if (ring->desc == NULL)
+	{
+		Kprintf("[dma_ring] no Emu68 RAM for %lu x %lu descriptors\n", count, elem_size);
+		return FALSE;
+	}
+
+	ring->elem_size = elem_size;
+	ring->count = count;
+	ring->mask = count - 1;
+	ring->head = 0;
+	ring->published = 0;
+	ring->tail = 0;
+	ring->pool = pool;
+
+	dma_ring_sync(ring, 0, count, TRUE);
+	return TRUE;
+}
+
+void dma_ring_free(struct dma_ring *ring)
+{
+	if (ring->desc)
+	{
+		dma_free(ring->pool, ring->desc);
+		ring->desc = NULL;
+	}
+}
+
+ULONG dma_ring_publish(struct dma_ring *ring)
+{
+	ULONG n = ring->head - ring->published;
+
+	if (n)
+	{
+		dma_ring_sync(ring, ring->published, n, TRUE);
+		ring->published = ring->head;
+	}
+	return ring->head;
+}
+
+ULONG dma_ring_reclaim(struct dma_ring *ring, ULONG hw_idx)
+{
+	ULONG n = (hw_idx - ring->tail) & ring->mask;
+
+	/* A device index beyond what was handed to it is bogus: never reclaim
+	 * descriptors the CPU still owns. */
+	if (unlikely(n > ring->published - ring->tail))
+		return 0;
+
+	if (n)
+	{
+		dma_ring_sync(ring, ring->tail, n, FALSE);
+		ring->tail += n;
+	}
+	return n;
+}
@@ -0,0 +1,72 @@
+// SPDX-License-Identifier: MPL-2.0 OR GPL-2.0+
+#ifdef __INTELLISENSE__
+#include <clib/exec_protos.h>
+#else
+#define __NOLIBBASE__
+#define EXEC_BASE_NAME (*(struct ExecBase **)4UL)
+#include <proto/exec.h>
+#endif
+
+#include <kmalloc.h>
+#include <bits.h>
+#include <debug.h>
+
+/* Bytes per slab: small enough that 17 classes do not pin megabytes between them,
+ * large enough that growth is rare. */
+#define KMALLOC_SLAB_SIZE 16384UL
+
+static ULONG kmalloc_class_size(ULONG idx)
+{
+	return (idx & 1 ? 24UL : 16UL) << (idx / 2);
+}
+
+void kmalloc_init(struct kmalloc_heap *heap, APTR meta_pool, struct dma_pool *dma_pool)
+{
+	ULONG align = dma_pool ? DMA_ALIGN_MIN : sizeof(APTR);
+
+	for (ULONG i = 0; i < KMALLOC_CLASSES; i++) {
+		ULONG size = ALIGN_UP(kmalloc_class_size(i), align);
+
+		/* Classes that round up to the same object size share its cache. */
+		if (i > 0 && heap->cache[i - 1]->obj_size == size) {
+			heap->cache[i] = heap->cache[i - 1];
+			continue;
+		}
+
+		ULONG capacity = KMALLOC_SLAB_SIZE / size;
+		if (capacity < 4)
+			capacity = 4;
+
+		heap->cache[i] = &heap->caches[i];
+		slab_cache_init(heap->cache[i], meta_pool, dma_pool, size, align, capacity);
+	}
+}
+
+void kmalloc_destroy(struct kmalloc_heap *heap)
+{
+	for (ULONG i = 0; i < KMALLOC_CLASSES; i++) {
+		if (heap->cache[i] == &heap->caches[i])
+			slab_cache_destroy(heap->cache[i]);
+	}
+}
+
+ULONG kmalloc_shrink(struct kmalloc_heap *heap)
+{
+	ULONG released = 0;
+
+	for (ULONG i = 0; i < KMALLOC_CLASSES; i++) {
+		if (heap->cache[i] == &heap->caches[i])
+			released += slab_shrink(heap->cache[i]);
+	}
+	return released;
+}
+
+#ifdef MEM_STATS
+void kmalloc_stats_dump(struct kmalloc_heap *heap, CONST_STRPTR name)
+{
+	for (ULONG i = 0; i < KMALLOC_CLASSES; i++) {
+		if (heap->cache[i] == &heap->caches[i] && heap->cache[i]->stats.allocs)
+			slab_cache_stats_dump(heap->cache[i], name);
+	}
+}
+#endif
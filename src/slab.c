@@ -10,11 +10,32 @@
 #include <slab.h>
 #include <memory.h>
 #include <bits.h>
+#include <debug.h>
 
 #define SLAB_DEFAULT_SIZE 262144UL
 
-void slab_cache_init(struct slab_cache *cache, APTR meta_pool, struct dma_pool *dma_pool,
-                     ULONG obj_size, ULONG obj_align, ULONG slab_capacity)
+/* Slab colouring: each new slab starts its objects one colour step further in, so
+ * the same object index in different slabs lands in different cache sets.  Steps
+ * are cache lines (or the object alignment if larger), rotating through a few
+ * lines; a slab pays for the span only when that costs at most 1/64 of it. */
+#define SLAB_COLOUR_LINE 64UL
+#define SLAB_COLOUR_SPAN 512UL
+
+/* Keeps the compiler from reordering the stores an interrupt-time slab_owner()
+ * (slab_free_irq() on a SLAB_LINK_SIDE cache) may observe. */
+#define slab_barrier() asm volatile("" ::: "memory")
+
+/* The cache's slabs sorted by first-object address.  slab_grow() publishes a new
+ * copy with one pointer store; slab_shrink() compacts it in place, so a lookup
+ * from an interrupt always finds every slab that still has objects in use. */
+struct slab_index {
+	ULONG             count;
+	struct slab_node *node[];
+};
+
+void slab_cache_init_ctor(struct slab_cache *cache, APTR meta_pool, struct dma_pool *dma_pool,
+                          ULONG obj_size, ULONG obj_align, ULONG slab_capacity,
+                          slab_ctor_t ctor, slab_dtor_t dtor, APTR user)
 {
 	/* DMA data must own whole cache lines; CPU-only data just needs to thread the
 	 * free list, so pointer alignment is enough. */
@@ -22,6 +43,21 @@ void slab_cache_init(struct slab_cache *cache, APTR meta_pool, struct dma_pool *
 	if (obj_align < min_align)
 		obj_align = min_align;
 
+	/* A constructed object must survive the free list, so the link goes in a
+	 * spare padding word after the object.  Without one, pointer-aligned objects
+	 * grow by that word; coarser-aligned ones would grow by a whole alignment step,
+	 * so their links go in the slab's side array instead. */
+	ULONG link_off = 0;
+	if (ctor) {
+		link_off = ALIGN_UP(obj_size, sizeof(APTR));
+		if (ALIGN_UP(obj_size, obj_align) - link_off < sizeof(APTR)) {
+			if (obj_align > sizeof(APTR))
+				link_off = SLAB_LINK_SIDE;
+			else
+				obj_size = link_off + sizeof(APTR);
+		}
+	}
+
 	obj_size = ALIGN_UP(obj_size, obj_align);
 
 	if (slab_capacity == 0) {
@@ -31,12 +67,65 @@ void slab_cache_init(struct slab_cache *cache, APTR meta_pool, struct dma_pool *
 	}
 
 	cache->free_list     = NULL;
+	cache->irq_pending   = NULL;
+	cache->clean_list    = NULL;
+	cache->bump          = NULL;
+	cache->bump_end      = NULL;
+	cache->bump_clean    = FALSE;
+	cache->prezero       = FALSE;
 	cache->meta_pool     = meta_pool;
 	cache->dma_pool      = dma_pool;
 	cache->slabs         = NULL;
+	cache->index         = NULL;
 	cache->obj_size      = obj_size;
 	cache->obj_align     = obj_align;
 	cache->slab_capacity = slab_capacity;
+	cache->link_off      = link_off;
+	cache->ctor          = ctor;
+	cache->dtor          = dtor;
+	cache->ctor_user     = user;
+
+	ULONG step = obj_align > SLAB_COLOUR_LINE ? obj_align : SLAB_COLOUR_LINE;
+	if (step * 2 <= SLAB_COLOUR_SPAN &&
+	    SLAB_COLOUR_SPAN <= obj_size * slab_capacity / 64) {
+		cache->colour_step = step;
+		cache->colour_span = SLAB_COLOUR_SPAN - step;
+	} else {
+		cache->colour_step = 0;
+		cache->colour_span = 0;
+	}
+	cache->colour_next = 0;
+#ifdef MEM_STATS
+	memset(&cache->stats, 0, sizeof(cache->stats));
+#endif
+}
+
+void slab_cache_init(struct slab_cache *cache, APTR meta_pool, struct dma_pool *dma_pool,
+                     ULONG obj_size, ULONG obj_align, ULONG slab_capacity)
+{
+	slab_cache_init_ctor(cache, meta_pool, dma_pool, obj_size, obj_align, slab_capacity,
+	                     NULL, NULL, NULL);
+}
+
+static void slab_release(struct slab_cache *cache, struct slab_node *node)
+{
+	if (cache->dtor) {
+		/* Everything below the bump pointer was handed out, hence constructed.  The
+		 * bump region is this slab's only if it ends where the slab does: a used-up
+		 * one sits at its end, which may be where the next slab starts. */
+		ULONG span = cache->obj_size * cache->slab_capacity;
+		char *end = node->objs + span;
+		if (cache->bump_end == end)
+			end = cache->bump;
+		for (char *obj = node->objs; obj < end; obj += cache->obj_size)
+			cache->dtor(obj, cache->ctor_user);
+	}
+
+	if (cache->dma_pool)
+		dma_free(cache->dma_pool, node->data);
+	else
+		pool_free(cache->meta_pool, node->data);
+	pool_free(cache->meta_pool, node);
 }
 
 void slab_cache_destroy(struct slab_cache *cache)
@@ -45,49 +134,350 @@ void slab_cache_destroy(struct slab_cache *cache)
 
 	while (node) {
 		struct slab_node *next = node->next;
-		if (cache->dma_pool)
-			dma_free(cache->dma_pool, node->data);
-		else
-			pool_free(cache->meta_pool, node->data);
-		pool_free(cache->meta_pool, node);
+		slab_release(cache, node);
 		node = next;
 	}
 
-	cache->free_list = NULL;
-	cache->slabs     = NULL;
+	cache->free_list   = NULL;
+	cache->irq_pending = NULL;
+	cache->clean_list  = NULL;
+	cache->bump        = NULL;
+	cache->bump_end    = NULL;
+	cache->slabs       = NULL;
+	pool_free(cache->meta_pool, cache->index);
+	cache->index       = NULL;
+#ifdef MEM_STATS
+	cache->stats.slabs = 0;
+#endif
+}
+
+/* Publish @cache's index with @node added in address order. */
+static BOOL slab_index_add(struct slab_cache *cache, struct slab_node *node)
+{
+	struct slab_index *old = cache->index;
+	ULONG count = old ? old->count : 0;
+	struct slab_index *index = pool_alloc(cache->meta_pool,
+	                                      sizeof(*index) + (count + 1) * sizeof(index->node[0]));
+	if (!index)
+		return FALSE;
+
+	ULONG i = 0, j = 0;
+	while (i < count && old->node[i]->objs < node->objs)
+		index->node[j++] = old->node[i++];
+	index->node[j++] = node;
+	while (i < count)
+		index->node[j++] = old->node[i++];
+	index->count = j;
+
+	slab_barrier();
+	cache->index = index;
+	slab_barrier();
+	pool_free(cache->meta_pool, old);
+	return TRUE;
 }
 
 void *slab_grow(struct slab_cache *cache)
 {
-	struct slab_node *node = pool_alloc(cache->meta_pool, sizeof(*node));
+	ULONG links = cache->link_off == SLAB_LINK_SIDE ? cache->slab_capacity * sizeof(APTR) : 0;
+	struct slab_node *node = pool_alloc(cache->meta_pool, sizeof(*node) + links);
 	if (!node)
 		return NULL;
 
 	ULONG data_size = cache->obj_size * cache->slab_capacity;
+	ULONG alloc_size = data_size + cache->colour_span;
 	void *data = cache->dma_pool
-		? dma_alloc(cache->dma_pool, cache->obj_align, data_size)
-		: pool_alloc(cache->meta_pool, data_size);
+		? dma_alloc(cache->dma_pool, cache->obj_align, alloc_size)
+		: pool_alloc(cache->meta_pool, alloc_size);
 	if (!data) {
 		pool_free(cache->meta_pool, node);
 		return NULL;
 	}
 
+	char *objs = (char *)data + cache->colour_next;
 	node->data  = data;
+	node->objs  = objs;
+	node->free  = 0;
+	node->links = links ? (void **)(node + 1) : NULL;
+	if (!slab_index_add(cache, node)) {
+		if (cache->dma_pool)
+			dma_free(cache->dma_pool, data);
+		else
+			pool_free(cache->meta_pool, data);
+		pool_free(cache->meta_pool, node);
+		return NULL;
+	}
+
+	if (cache->colour_step) {
+		cache->colour_next += cache->colour_step;
+		if (cache->colour_next > cache->colour_span)
+			cache->colour_next = 0;
+	}
+
 	node->next  = cache->slabs;
 	cache->slabs = node;
+#ifdef MEM_STATS
+	cache->stats.slabs++;
+#endif
+
+	/* slot[0] goes to the caller; the rest is carved on demand, never threaded. */
+	cache->bump       = objs;
+	cache->bump_end   = objs + data_size;
+	cache->bump_clean = cache->prezero;
+	if (cache->prezero)
+		memset(objs, 0, data_size);
+
+	if (cache->ctor && !cache->ctor(objs, cache->ctor_user))
+		return NULL;
+	cache->bump += cache->obj_size;
+
+	return objs;
+}
+
+void *slab_take_irq(struct slab_cache *cache)
+{
+	void *chain = cache->irq_pending;
+	void *seen;
+
+	while (chain && (seen = slab_cas(&cache->irq_pending, chain, NULL)) != chain)
+		chain = seen;
+	if (!chain)
+		return cache->free_list;
+
+#ifdef MEM_STATS
+	for (void *obj = chain; obj; obj = *slab_link(cache, obj))
+		slab_stat_free(cache);
+#endif
+
+	if (cache->free_list) {
+		void *tail = chain;
+		while (*slab_link(cache, tail))
+			tail = *slab_link(cache, tail);
+		*slab_link(cache, tail) = cache->free_list;
+	}
+	cache->free_list = chain;
+	return chain;
+}
+
+/* Carve up to @n objects off the bump region into @out; stops early when it runs
+ * out or a constructor fails. */
+static ULONG slab_take_bump(struct slab_cache *cache, ULONG n, void **out)
+{
+	ULONG got = 0;
+
+	while (got < n && cache->bump != cache->bump_end) {
+		if (cache->ctor && !cache->ctor(cache->bump, cache->ctor_user))
+			break;
+		out[got++] = cache->bump;
+		cache->bump += cache->obj_size;
+	}
+	return got;
+}
+
+ULONG slab_alloc_bulk(struct slab_cache *cache, ULONG n, void **out)
+{
+	void *obj = cache->free_list;
+	ULONG got = 0;
+
+	for (;;) {
+		while (got < n && obj) {
+			out[got++] = obj;
+			obj = *slab_link(cache, obj);
+		}
+		cache->free_list = obj;
+		if (got == n || !cache->irq_pending)
+			break;
+		obj = slab_take_irq(cache);
+	}
 
-	ULONG sz = cache->obj_size;
-	const ULONG n  = cache->slab_capacity;
-	char *slot = (char *)data;
+	for (obj = cache->clean_list; got < n && obj; obj = *slab_link(cache, obj))
+		out[got++] = obj;
+	cache->clean_list = obj;
 
-	for (ULONG i = 0; i < n - 1; i++, slot += sz)
-		*(void **)slot = slot + sz;
+	got += slab_take_bump(cache, n - got, out + got);
 
-	*(void **)slot  = cache->free_list;
-	/* slot[0] is returned to the caller; chain head starts at slot[1] (or
-	 * the previous free_list if n == 1). */
-	cache->free_list = *(void **)data;
+	/* Grow only when the bump region is really empty, not on a constructor failure. */
+	if (got < n && cache->bump == cache->bump_end) {
+		obj = slab_grow(cache);
+		if (obj) {
+			out[got++] = obj;
+			got += slab_take_bump(cache, n - got, out + got);
+		}
+	}
+
+#ifdef MEM_STATS
+	cache->stats.allocs += got;
+	cache->stats.in_use += got;
+	if (cache->stats.in_use > cache->stats.high_water)
+		cache->stats.high_water = cache->stats.in_use;
+#endif
+	return got;
+}
+
+void slab_free_bulk(struct slab_cache *cache, ULONG n, void **in)
+{
+	if (n == 0)
+		return;
+
+	for (ULONG i = 0; i < n - 1; i++)
+		*slab_link(cache, in[i]) = in[i + 1];
+	*slab_link(cache, in[n - 1]) = cache->free_list;
+	cache->free_list = in[0];
+
+#ifdef MEM_STATS
+	cache->stats.frees += n;
+	cache->stats.in_use -= n;
+#endif
+}
+
+/* Slab holding @obj: a binary search of the index.  Safe from an interrupt that
+ * cut into slab_grow() / slab_shrink(); see struct slab_index. */
+static struct slab_node *slab_owner(const struct slab_cache *cache, void *obj)
+{
+	const struct slab_index *index = cache->index;
+	ULONG span = cache->obj_size * cache->slab_capacity;
+
+	if (!index)
+		return NULL;
+
+	/* Last slab starting at or below @obj. */
+	ULONG lo = 0, hi = index->count;
+	while (lo < hi) {
+		ULONG mid = (lo + hi) / 2;
+		if ((ULONG)index->node[mid]->objs <= (ULONG)obj)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (lo == 0)
+		return NULL;
+
+	struct slab_node *node = index->node[lo - 1];
+	return (ULONG)obj - (ULONG)node->objs < span ? node : NULL;
+}
+
+void **slab_side_link(const struct slab_cache *cache, void *obj)
+{
+	struct slab_node *node = slab_owner(cache, obj);
+
+	return &node->links[((ULONG)obj - (ULONG)node->objs) / cache->obj_size];
+}
+
+/* Credit each object on @list to its slab; returns how many slabs that filled. */
+static ULONG slab_count_free(struct slab_cache *cache, void *list)
+{
+	ULONG empty = 0;
+
+	for (void *obj = list; obj; obj = *slab_link(cache, obj)) {
+		struct slab_node *node = slab_owner(cache, obj);
+		if (node && ++node->free == cache->slab_capacity)
+			empty++;
+	}
+	return empty;
+}
+
+/* Unthread the empty slabs' objects from @head, keeping the rest in order. */
+static void slab_unthread_empty(struct slab_cache *cache, void **head)
+{
+	void **link = head;
+
+	while (*link) {
+		void *obj = *link;
+		struct slab_node *node = slab_owner(cache, obj);
+		if (node && node->free == cache->slab_capacity)
+			*link = *slab_link(cache, obj);
+		else
+			link = slab_link(cache, obj);
+	}
+}
+
+ULONG slab_shrink(struct slab_cache *cache)
+{
+	struct slab_node *node;
+	ULONG empty = 0;
+
+	slab_take_irq(cache);
+
+	for (node = cache->slabs; node; node = node->next)
+		node->free = 0;
+
+	/* The untouched tail of the newest slab is free as well. */
+	struct slab_node *bump_node = NULL;
+	if (cache->bump != cache->bump_end) {
+		bump_node = slab_owner(cache, cache->bump);
+		bump_node->free = (ULONG)(cache->bump_end - cache->bump) / cache->obj_size;
+		if (bump_node->free == cache->slab_capacity)
+			empty++;
+	}
+
+	empty += slab_count_free(cache, cache->free_list);
+	empty += slab_count_free(cache, cache->clean_list);
+	if (empty == 0)
+		return 0;
+
+	/* Unthreading reads the side links of the empty slabs: index them until then. */
+	slab_unthread_empty(cache, &cache->free_list);
+	slab_unthread_empty(cache, &cache->clean_list);
+
+	/* Compact the index in place: every slab still in use stays visible throughout,
+	 * and the stale tail is only dropped once the count is lowered. */
+	struct slab_index *index = cache->index;
+	ULONG kept = 0;
+	for (ULONG i = 0; i < index->count; i++) {
+		if (index->node[i]->free != cache->slab_capacity)
+			index->node[kept++] = index->node[i];
+	}
+	slab_barrier();
+	index->count = kept;
+	slab_barrier();
 
-	return data;
+	struct slab_node **pp = &cache->slabs;
+	while ((node = *pp) != NULL) {
+		if (node->free == cache->slab_capacity) {
+			*pp = node->next;
+			slab_release(cache, node);
+			if (node == bump_node)
+				cache->bump = cache->bump_end = NULL;
+		} else {
+			pp = &node->next;
+		}
+	}
+#ifdef MEM_STATS
+	cache->stats.slabs -= empty;
+#endif
+	return empty;
+}
+
+void slab_cache_set_prezero(struct slab_cache *cache, BOOL prezero)
+{
+	cache->prezero = cache->ctor ? FALSE : prezero;
 }
 
+ULONG slab_scrub(struct slab_cache *cache, ULONG max)
+{
+	ULONG done = 0;
+
+	if (cache->ctor)
+		return 0;
+
+	while (done < max && cache->free_list) {
+		void *obj = cache->free_list;
+		cache->free_list = *slab_link(cache, obj);
+		memset(obj, 0, cache->obj_size);
+		*slab_link(cache, obj) = cache->clean_list;
+		cache->clean_list = obj;
+		done++;
+	}
+	return done;
+}
+
+#ifdef MEM_STATS
+void slab_cache_stats_dump(struct slab_cache *cache, CONST_STRPTR name)
+{
+	const struct slab_stats *st = &cache->stats;
+	ULONG objs = st->slabs * cache->slab_capacity;
+
+	Kprintf("[%s] slab %lu B: %lu allocs, %lu frees; %lu in use (high %lu) of %lu in %lu slab(s), %lu%% full\n",
+			name, cache->obj_size, st->allocs, st->frees, st->in_use, st->high_water,
+			objs, st->slabs, objs ? st->in_use * 100UL / objs : 0UL);
+}
+#endif
@@ -0,0 +1,162 @@
+/* SPDX-License-Identifier: MPL-2.0 OR GPL-2.0+ */
+/*
+ * Alloc/free latency of the DMA region pool, replaying one random alloc/free mix
+ * over a pool whose puddles were first fragmented by long-lived blocks:
+ *
+ *   classes    raw power-of-two sizes, served by the size-class free lists;
+ *   memheader  the same sizes plus one MEM_BLOCKSIZE, which misses every class and
+ *              takes the first-fit Allocate() walk (the allocator before the class
+ *              front end);
+ *   header     64-byte-aligned payloads of 64 B .. 16 KB laid out as a header
+ *              dma_alloc() block (dma_alloc_total() + dma_alloc_finish(), as every
+ *              dma_alloc() was before payload classes): never a class size;
+ *   dma_alloc  dma_alloc(pool, 64, size) / dma_free() for the same payloads, each
+ *              a naturally aligned class block.
+ *
+ * Prints latency percentiles (host nanoseconds, clock read included) and the peak
+ * Emu68 RAM the pool took.  Absolute numbers are host numbers; compare the rows.
+ */
+
+#include "host_exec.h"
+
+#include <dma_mem.h>
+#include <string.h>
+
+#define RAM_BASE   0x20000000UL
+#define RAM_SIZE   (64UL << 20)
+#define SLOTS      1024
+#define BACKGROUND 2048
+#define OPS        200000
+
+enum mode
+{
+	MODE_CLASSES,
+	MODE_MEMHEADER,
+	MODE_HEADER,
+	MODE_DMA_ALLOC,
+};
+
+static const char *const mode_name[] = { "classes", "memheader", "header", "dma_alloc" };
+
+static const ULONG sizes[] = { 64, 64, 128, 256, 256, 512, 1024, 2048, 2048, 4096 };
+
+/* dma_alloc() payloads: odd sizes as well as powers of two. */
+static const ULONG payloads[] = { 64, 100, 128, 256, 300, 512, 1024, 1536, 2048, 4096, 9000, 16384 };
+
+static u64 alloc_ns[OPS];
+static u64 free_ns[OPS];
+
+static int cmp_u64(const void *a, const void *b)
+{
+	u64 x = *(const u64 *)a, y = *(const u64 *)b;
+	return x < y ? -1 : x > y;
+}
+
+static void report(const char *what, u64 *v, ULONG n)
+{
+	qsort(v, n, sizeof(*v), cmp_u64);
+	printf("  %-5s n=%-6lu p50 %5llu  p90 %5llu  p99 %6llu  max %7llu ns\n", what, n,
+		   (unsigned long long)v[n / 2], (unsigned long long)v[n * 9 / 10],
+		   (unsigned long long)v[n * 99 / 100], (unsigned long long)v[n - 1]);
+}
+
+static ULONG ram_taken(const struct MemHeader *mh)
+{
+	return ((ULONG)mh->mh_Upper - (ULONG)mh->mh_Lower) - mh->mh_Free;
+}
+
+struct slot
+{
+	APTR ptr;
+	APTR owner;
+	ULONG size;
+};
+
+static void run(enum mode mode)
+{
+	static struct MemHeader mh;
+	static struct slot live[SLOTS], background[BACKGROUND];
+	struct dma_mem_ctx ctx;
+	ULONG na = 0, nf = 0, peak = 0;
+
+	struct dma_pool *pool = host_dma_pool(&mh, &ctx, RAM_BASE, RAM_SIZE);
+	srand(7);
+
+	/* Long-lived blocks of odd sizes, every other one freed again: the first-fit
+	 * walk now passes a chunk list full of small holes. */
+	for (ULONG i = 0; i < BACKGROUND; i++)
+	{
+		background[i].size = 48 + 16 * ((ULONG)rand() % 24);
+		background[i].ptr = dma_pool_region_alloc_owned(pool, background[i].size, &background[i].owner);
+		HOST_CHECK(background[i].ptr != NULL);
+	}
+	for (ULONG i = 0; i < BACKGROUND; i += 2)
+		dma_pool_region_free_owned(pool, background[i].ptr, background[i].size, background[i].owner);
+
+	memset(live, 0, sizeof(live));
+	for (ULONG op = 0; op < OPS; op++)
+	{
+		struct slot *s = &live[(ULONG)rand() % SLOTS];
+		ULONG size = sizes[(ULONG)rand() % (sizeof(sizes) / sizeof(sizes[0]))];
+		u64 t0, t1;
+
+		if (mode >= MODE_HEADER)
+			size = payloads[(ULONG)rand() % (sizeof(payloads) / sizeof(payloads[0]))];
+
+		if (s->ptr)
+		{
+			t0 = host_now_ns();
+			if (mode == MODE_DMA_ALLOC)
+				dma_free(pool, s->ptr);
+			else if (mode == MODE_HEADER)
+			{
+				struct dma_alloc_hdr *raw = ((struct dma_alloc_hdr **)s->ptr)[-1];
+				dma_pool_region_free_owned(pool, raw, raw->total, raw->owner);
+			}
+			else
+				dma_pool_region_free_owned(pool, s->ptr, s->size, s->owner);
+			t1 = host_now_ns();
+			free_ns[nf++] = t1 - t0;
+			s->ptr = NULL;
+			continue;
+		}
+
+		if (mode == MODE_MEMHEADER)
+			size += MEM_BLOCKSIZE;
+		s->size = size;
+		t0 = host_now_ns();
+		if (mode == MODE_DMA_ALLOC)
+			s->ptr = dma_alloc(pool, 64, size);
+		else if (mode == MODE_HEADER)
+		{
+			ULONG align = 64;
+			ULONG total = dma_alloc_total(&align, size);
+			struct dma_alloc_hdr *raw = dma_pool_region_alloc_owned(pool, total, &s->owner);
+			s->ptr = dma_alloc_finish(raw, total, align, s->owner);
+		}
+		else
+			s->ptr = dma_pool_region_alloc_owned(pool, size, &s->owner);
+		t1 = host_now_ns();
+		HOST_CHECK(s->ptr != NULL);
+		alloc_ns[na++] = t1 - t0;
+		if (ram_taken(&mh) > peak)
+			peak = ram_taken(&mh);
+	}
+
+	printf("%s: peak Emu68 RAM %lu KB\n", mode_name[mode], peak >> 10);
+	report("alloc", alloc_ns, na);
+	report("free", free_ns, nf);
+
+	dma_pool_delete(pool);
+	dma_mem_exit(&ctx);
+}
+
+int main(void)
+{
+	host_ram(RAM_BASE, RAM_SIZE);
+	run(MODE_MEMHEADER);
+	run(MODE_CLASSES);
+	run(MODE_HEADER);
+	run(MODE_DMA_ALLOC);
+	return 0;
+}
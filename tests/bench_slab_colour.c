@@ -0,0 +1,191 @@
+/* SPDX-License-Identifier: MPL-2.0 OR GPL-2.0+ */
+/*
+ * Conflict misses of slab colouring, on a simulated set-associative LRU data cache.
+ * A DMA slab cache of 64-byte objects in 32 KB slabs is filled, then the hot header
+ * line of the first few objects of every slab is walked over and over: the working
+ * set a driver keeps when its live objects are spread over many slabs.  The same
+ * walk runs with colouring off (colour_step = 0) and on, against the geometries the
+ * code runs under:
+ *
+ *   68040      4 KB, 4-way, 16 B lines (the m68k data cache);
+ *   Emu68 A53  32 KB, 4-way, 64 B lines (Pi 3 L1D the JIT code loads through);
+ *   Emu68 A72  32 KB, 2-way, 64 B lines (Pi 4 L1D).
+ *
+ * Prints the sets the headers land in and the misses per pass after a warm-up
+ * pass.  A working set no larger than the cache misses only on conflicts, so the
+ * off/on rows differ only by what colouring spreads out.
+ */
+
+#include "host_exec.h"
+
+#include <slab.h>
+#include <string.h>
+
+#define RAM_BASE  0x50000000UL
+#define RAM_SIZE  (64UL << 20)
+#define OBJ_SIZE  64
+#define CAPACITY  512 /* 32 KB slabs: the smallest that colour */
+#define MAX_SLABS 64
+#define HOT       4   /* hot objects per slab */
+#define HEADER    16  /* hot bytes at the start of each object */
+#define PASSES    16
+#define MAX_LINES 2048
+
+struct geometry
+{
+	const char *name;
+	ULONG size;
+	ULONG ways;
+	ULONG line;
+};
+
+static const struct geometry geometries[] = {
+	{ "68040", 4096, 4, 16 },
+	{ "Emu68 A53", 32768, 4, 64 },
+	{ "Emu68 A72", 32768, 2, 64 },
+};
+
+/* LRU set-associative cache: way 0 of a set is the most recently used. */
+struct cache_model
+{
+	const struct geometry *g;
+	ULONG sets;
+	ULONG tag[MAX_LINES];
+	UBYTE valid[MAX_LINES];
+};
+
+static void model_init(struct cache_model *m, const struct geometry *g)
+{
+	m->g = g;
+	m->sets = g->size / (g->ways * g->line);
+	HOST_CHECK(m->sets * g->ways <= MAX_LINES);
+	memset(m->valid, 0, sizeof(m->valid));
+}
+
+static ULONG model_set(const struct cache_model *m, ULONG addr)
+{
+	return (addr / m->g->line) % m->sets;
+}
+
+/* Touch one byte; returns 1 on a miss. */
+static ULONG model_access(struct cache_model *m, ULONG addr)
+{
+	ULONG line = addr / m->g->line;
+	ULONG *tag = &m->tag[model_set(m, addr) * m->g->ways];
+	UBYTE *valid = &m->valid[model_set(m, addr) * m->g->ways];
+	ULONG w, miss = 0;
+
+	for (w = 0; w < m->g->ways; w++)
+	{
+		if (valid[w] && tag[w] == line)
+			break;
+	}
+	if (w == m->g->ways)
+	{
+		w = m->g->ways - 1; /* evict the least recently used */
+		miss = 1;
+	}
+	for (; w > 0; w--)
+	{
+		tag[w] = tag[w - 1];
+		valid[w] = valid[w - 1];
+	}
+	tag[0] = line;
+	valid[0] = 1;
+	return miss;
+}
+
+/* Header addresses of the first HOT objects of each of @slabs slabs. */
+static ULONG fill_cache(struct dma_pool *pool, BOOL colour, ULONG slabs, ULONG *hot)
+{
+	static APTR objs[MAX_SLABS * CAPACITY];
+	struct slab_cache cache;
+	ULONG n = 0;
+
+	slab_cache_init(&cache, &cache, pool, OBJ_SIZE, 0, CAPACITY);
+	HOST_CHECK(cache.colour_step != 0);
+	if (!colour)
+	{
+		cache.colour_step = 0;
+		cache.colour_span = 0;
+	}
+
+	/* A fresh cache hands out each slab's objects in order. */
+	for (ULONG i = 0; i < slabs * CAPACITY; i++)
+	{
+		objs[i] = slab_alloc(&cache);
+		HOST_CHECK(objs[i] != NULL);
+		if (i % CAPACITY < HOT)
+			hot[n++] = (ULONG)objs[i];
+	}
+	for (ULONG i = 0; i < slabs * CAPACITY; i++)
+		slab_free(&cache, objs[i]);
+	slab_cache_destroy(&cache);
+	return n;
+}
+
+static void run(struct dma_pool *pool, ULONG slabs)
+{
+	static ULONG hot[2][MAX_SLABS * HOT];
+	ULONG n = 0;
+
+	for (int colour = 0; colour < 2; colour++)
+		n = fill_cache(pool, colour, slabs, hot[colour]);
+
+	for (ULONG gi = 0; gi < sizeof(geometries) / sizeof(geometries[0]); gi++)
+	{
+		const struct geometry *g = &geometries[gi];
+		ULONG lines = n * ((HEADER + g->line - 1) / g->line);
+
+		printf("  %-9s %3lu slabs %4lu lines (cache %4lu):", g->name, slabs, lines,
+			   g->size / g->line);
+		for (int colour = 0; colour < 2; colour++)
+		{
+			static struct cache_model m;
+			static UBYTE used[MAX_LINES];
+			ULONG sets = 0, misses = 0;
+
+			model_init(&m, g);
+			memset(used, 0, sizeof(used));
+			for (ULONG i = 0; i < n; i++)
+			{
+				if (!used[model_set(&m, hot[colour][i])]++)
+					sets++;
+			}
+			for (ULONG pass = 0; pass <= PASSES; pass++)
+			{
+				for (ULONG i = 0; i < n; i++)
+				{
+					for (ULONG b = 0; b < HEADER; b += g->line)
+					{
+						ULONG miss = model_access(&m, hot[colour][i] + b);
+						if (pass > 0)
+							misses += miss;
+					}
+				}
+			}
+			printf("  %s %3lu sets %5lu misses/pass", colour ? "on " : "off", sets,
+				   misses / PASSES);
+		}
+		printf("\n");
+	}
+}
+
+int main(void)
+{
+	static struct MemHeader mh;
+	struct dma_mem_ctx ctx;
+
+	host_ram(RAM_BASE, RAM_SIZE);
+	struct dma_pool *pool = host_dma_pool(&mh, &ctx, RAM_BASE, RAM_SIZE);
+
+	printf("colouring off / on, %d hot objects per slab, %d-byte headers:\n", HOT, HEADER);
+	run(pool, 8);
+	run(pool, 16);
+	run(pool, 32);
+	run(pool, 64);
+
+	dma_pool_delete(pool);
+	dma_mem_exit(&ctx);
+	return 0;
+}
@@ -0,0 +1,547 @@
+/* SPDX-License-Identifier: MPL-2.0 OR GPL-2.0+ */
+/* Host implementation of the Exec / devicetree.resource calls; see host_exec.h. */
+
+#define _GNU_SOURCE
+#include "host_exec.h"
+
+#include <proto/devicetree.h>
+#include <debug.h>
+#include <dma_mem.h>
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+
+struct ExecBase *SysBase;
+
+static struct ExecBase host_execbase;
+static pthread_mutex_t host_forbid_lock;
+
+ULONG host_cache_pre_calls;
+ULONG host_cache_post_calls;
+ULONG host_semaphore_obtains;
+ULONG host_kprintf_count;
+char host_kprintf_last[256];
+
+static pthread_mutex_t host_kprintf_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* --- Setup ------------------------------------------------------------------- */
+
+static void host_new_list(struct List *list)
+{
+	list->lh_Head = (struct Node *)&list->lh_Tail;
+	list->lh_Tail = NULL;
+	list->lh_TailPred = (struct Node *)&list->lh_Head;
+}
+
+static void host_dt_reset(void);
+
+void host_exec_init(void)
+{
+	static BOOL once;
+
+	if (!once)
+	{
+		pthread_mutexattr_t attr;
+		pthread_mutexattr_init(&attr);
+		pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+		pthread_mutex_init(&host_forbid_lock, &attr);
+		pthread_mutexattr_destroy(&attr);
+		once = TRUE;
+	}
+
+	SysBase = &host_execbase;
+	host_new_list(&host_execbase.MemList);
+	host_cache_pre_calls = 0;
+	host_cache_post_calls = 0;
+	host_semaphore_obtains = 0;
+	host_kprintf_reset();
+	host_dt_reset();
+}
+
+void *host_ram(ULONG base, ULONG size)
+{
+	void *p = mmap((void *)base, size, PROT_READ | PROT_WRITE,
+				   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED_NOREPLACE, -1, 0);
+	if (p != (void *)base)
+	{
+		fprintf(stderr, "host_ram: cannot map %08lx..%08lx\n", base, base + size - 1);
+		exit(1);
+	}
+	return p;
+}
+
+void host_ram_free(ULONG base, ULONG size)
+{
+	munmap((void *)base, size);
+}
+
+void host_add_header(struct MemHeader *mh, ULONG lower, ULONG size, UWORD attributes)
+{
+	memset(mh, 0, sizeof(*mh));
+	mh->mh_Attributes = attributes;
+	mh->mh_Lower = (APTR)lower;
+	mh->mh_Upper = (APTR)(lower + size);
+	mh->mh_Free = size;
+	mh->mh_First = (struct MemChunk *)lower;
+	mh->mh_First->mc_Next = NULL;
+	mh->mh_First->mc_Bytes = size;
+	AddTail(&SysBase->MemList, &mh->mh_Node);
+}
+
+u64 host_now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u64)ts.tv_sec * 1000000000ULL + (u64)ts.tv_nsec;
+}
+
+/* --- Memory ------------------------------------------------------------------ */
+
+APTR Allocate(struct MemHeader *mh, ULONG size)
+{
+	size = (size + MEM_BLOCKSIZE - 1) & ~(MEM_BLOCKSIZE - 1);
+	if (size == 0 || size > mh->mh_Free)
+		return NULL;
+
+	for (struct MemChunk **pp = &mh->mh_First, *c = *pp; c != NULL; pp = &c->mc_Next, c = *pp)
+	{
+		if (c->mc_Bytes < size)
+			continue;
+
+		if (c->mc_Bytes == size)
+		{
+			*pp = c->mc_Next;
+		}
+		else
+		{
+			struct MemChunk *rest = (struct MemChunk *)((UBYTE *)c + size);
+			rest->mc_Next = c->mc_Next;
+			rest->mc_Bytes = c->mc_Bytes - size;
+			*pp = rest;
+		}
+		mh->mh_Free -= size;
+		return c;
+	}
+	return NULL;
+}
+
+void Deallocate(struct MemHeader *mh, APTR block, ULONG size)
+{
+	if (block == NULL || size == 0)
+		return;
+
+	ULONG a = (ULONG)block & ~(MEM_BLOCKSIZE - 1);
+	size = ((ULONG)block - a + size + MEM_BLOCKSIZE - 1) & ~(MEM_BLOCKSIZE - 1);
+
+	struct MemChunk *prev = NULL, *next = mh->mh_First;
+	while (next != NULL && (ULONG)next < a)
+	{
+		prev = next;
+		next = next->mc_Next;
+	}
+
+	/* A double or overlapping free is a library bug: stop right there. */
+	if (a < (ULONG)mh->mh_Lower || a + size > (ULONG)mh->mh_Upper ||
+		(next != NULL && a + size > (ULONG)next) ||
+		(prev != NULL && (ULONG)prev + prev->mc_Bytes > a))
+	{
+		fprintf(stderr, "Deallocate: bad free %08lx+%lu\n", a, size);
+		abort();
+	}
+
+	struct MemChunk *c = (struct MemChunk *)a;
+	c->mc_Bytes = size;
+	c->mc_Next = next;
+	if (next != NULL && a + size == (ULONG)next)
+	{
+		c->mc_Bytes += next->mc_Bytes;
+		c->mc_Next = next->mc_Next;
+	}
+
+	if (prev == NULL)
+	{
+		mh->mh_First = c;
+	}
+	else if ((ULONG)prev + prev->mc_Bytes == a)
+	{
+		prev->mc_Bytes += c->mc_Bytes;
+		prev->mc_Next = c->mc_Next;
+	}
+	else
+	{
+		prev->mc_Next = c;
+	}
+	mh->mh_Free += size;
+}
+
+APTR AllocAbs(ULONG size, APTR location)
+{
+	ULONG a = (ULONG)location & ~(MEM_BLOCKSIZE - 1);
+	size = ((ULONG)location - a + size + MEM_BLOCKSIZE - 1) & ~(MEM_BLOCKSIZE - 1);
+	APTR result = NULL;
+
+	Forbid();
+	for (struct Node *n = SysBase->MemList.lh_Head; n->ln_Succ != NULL; n = n->ln_Succ)
+	{
+		struct MemHeader *mh = (struct MemHeader *)n;
+		if (a < (ULONG)mh->mh_Lower || a >= (ULONG)mh->mh_Upper)
+			continue;
+
+		for (struct MemChunk **pp = &mh->mh_First, *c = *pp; c != NULL; pp = &c->mc_Next, c = *pp)
+		{
+			ULONG cs = (ULONG)c, ce = cs + c->mc_Bytes;
+			if (a < cs || a + size > ce)
+				continue;
+
+			struct MemChunk *next = c->mc_Next;
+			if (a + size < ce)
+			{
+				struct MemChunk *tail = (struct MemChunk *)(a + size);
+				tail->mc_Bytes = ce - a - size;
+				tail->mc_Next = next;
+				next = tail;
+			}
+			if (a > cs)
+			{
+				c->mc_Bytes = a - cs;
+				c->mc_Next = next;
+			}
+			else
+			{
+				*pp = next;
+			}
+			mh->mh_Free -= size;
+			result = (APTR)a;
+			break;
+		}
+		break;
+	}
+	Permit();
+	return result;
+}
+
+/* CPU-side allocations come from the host heap, like any other Exec memory type. */
+APTR AllocMem(ULONG size, ULONG flags)
+{
+	APTR p = aligned_alloc(MEM_BLOCKSIZE, (size + MEM_BLOCKSIZE - 1) & ~(MEM_BLOCKSIZE - 1));
+	if (p != NULL && (flags & MEMF_CLEAR))
+		memset(p, 0, size);
+	return p;
+}
+
+void FreeMem(APTR block, ULONG size)
+{
+	(void)size;
+	free(block);
+}
+
+APTR AllocPooled(APTR pool, ULONG size)
+{
+	(void)pool;
+	return AllocMem(size, MEMF_PUBLIC);
+}
+
+void FreePooled(APTR pool, APTR block, ULONG size)
+{
+	(void)pool;
+	FreeMem(block, size);
+}
+
+void CopyMem(const void *src, void *dst, ULONG size)
+{
+	memmove(dst, src, size);
+}
+
+/* --- Arbitration ------------------------------------------------------------- */
+
+void Forbid(void)
+{
+	pthread_mutex_lock(&host_forbid_lock);
+}
+
+void Permit(void)
+{
+	pthread_mutex_unlock(&host_forbid_lock);
+}
+
+void Disable(void)
+{
+	pthread_mutex_lock(&host_forbid_lock);
+}
+
+void Enable(void)
+{
+	pthread_mutex_unlock(&host_forbid_lock);
+}
+
+void InitSemaphore(struct SignalSemaphore *sem)
+{
+	pthread_mutexattr_t attr;
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(&sem->ss_HostMutex, &attr);
+	pthread_mutexattr_destroy(&attr);
+}
+
+void ObtainSemaphore(struct SignalSemaphore *sem)
+{
+	__atomic_add_fetch(&host_semaphore_obtains, 1, __ATOMIC_RELAXED);
+	pthread_mutex_lock(&sem->ss_HostMutex);
+}
+
+void ReleaseSemaphore(struct SignalSemaphore *sem)
+{
+	pthread_mutex_unlock(&sem->ss_HostMutex);
+}
+
+/* --- Lists ------------------------------------------------------------------- */
+
+void AddHead(struct List *list, struct Node *node)
+{
+	node->ln_Succ = list->lh_Head;
+	node->ln_Pred = (struct Node *)&list->lh_Head;
+	list->lh_Head->ln_Pred = node;
+	list->lh_Head = node;
+}
+
+void AddTail(struct List *list, struct Node *node)
+{
+	node->ln_Succ = (struct Node *)&list->lh_Tail;
+	node->ln_Pred = list->lh_TailPred;
+	list->lh_TailPred->ln_Succ = node;
+	list->lh_TailPred = node;
+}
+
+void Remove(struct Node *node)
+{
+	node->ln_Pred->ln_Succ = node->ln_Succ;
+	node->ln_Succ->ln_Pred = node->ln_Pred;
+}
+
+struct Node *RemHead(struct List *list)
+{
+	struct Node *node = list->lh_Head;
+	if (node->ln_Succ == NULL)
+		return NULL;
+	Remove(node);
+	return node;
+}
+
+/* --- Caches ------------------------------------------------------------------ */
+
+/* The host is coherent: only count the calls. */
+APTR CachePreDMA(APTR addr, ULONG *len, ULONG flags)
+{
+	(void)len;
+	(void)flags;
+	__atomic_add_fetch(&host_cache_pre_calls, 1, __ATOMIC_RELAXED);
+	return addr;
+}
+
+void CachePostDMA(APTR addr, ULONG *len, ULONG flags)
+{
+	(void)addr;
+	(void)len;
+	(void)flags;
+	__atomic_add_fetch(&host_cache_post_calls, 1, __ATOMIC_RELAXED);
+}
+
+/* --- Debug output ------------------------------------------------------------ */
+
+void host_kprintf(const char *fmt, ...)
+{
+	va_list args;
+
+	pthread_mutex_lock(&host_kprintf_lock);
+	va_start(args, fmt);
+	vsnprintf(host_kprintf_last, sizeof(host_kprintf_last), fmt, args);
+	va_end(args);
+	host_kprintf_count++;
+	if (getenv("HOST_KPRINTF"))
+		fputs(host_kprintf_last, stderr);
+	pthread_mutex_unlock(&host_kprintf_lock);
+}
+
+void host_kprintf_reset(void)
+{
+	pthread_mutex_lock(&host_kprintf_lock);
+	host_kprintf_count = 0;
+	host_kprintf_last[0] = 0;
+	pthread_mutex_unlock(&host_kprintf_lock);
+}
+
+/* --- Resources / device tree ------------------------------------------------- */
+
+#define HOST_DT_MAX_NODES 64
+#define HOST_DT_MAX_PROPS 256
+#define HOST_DT_MAX_CELLS 64
+
+struct host_dt_prop
+{
+	struct host_dt_node *node;
+	char name[32];
+	u32 cells[HOST_DT_MAX_CELLS];
+	ULONG len; /* bytes */
+};
+
+struct host_dt_node
+{
+	struct host_dt_node *parent;
+	char name[32];
+};
+
+static struct host_dt_node host_dt_nodes[HOST_DT_MAX_NODES];
+static struct host_dt_prop host_dt_props[HOST_DT_MAX_PROPS];
+static ULONG host_dt_node_count;
+static ULONG host_dt_prop_count;
+
+APTR OpenResource(CONST_STRPTR name)
+{
+	(void)name;
+	return &host_dt_nodes[0];
+}
+
+static void host_dt_reset(void)
+{
+	host_dt_node_count = 1; /* the root, name "" */
+	host_dt_prop_count = 0;
+	memset(&host_dt_nodes[0], 0, sizeof(host_dt_nodes[0]));
+}
+
+static struct host_dt_node *host_dt_lookup_child(struct host_dt_node *parent, const char *name, size_t len)
+{
+	for (ULONG i = 1; i < host_dt_node_count; i++)
+	{
+		struct host_dt_node *n = &host_dt_nodes[i];
+		if (n->parent == parent && strlen(n->name) == len && memcmp(n->name, name, len) == 0)
+			return n;
+	}
+	return NULL;
+}
+
+struct host_dt_node *host_dt_node(struct host_dt_node *parent, const char *name)
+{
+	if (parent == NULL)
+		return &host_dt_nodes[0];
+
+	struct host_dt_node *n = host_dt_lookup_child(parent, name, strlen(name));
+	if (n != NULL)
+		return n;
+
+	HOST_CHECK(host_dt_node_count < HOST_DT_MAX_NODES && strlen(name) < sizeof(n->name));
+	n = &host_dt_nodes[host_dt_node_count++];
+	n->parent = parent;
+	strcpy(n->name, name);
+	return n;
+}
+
+void host_dt_prop(struct host_dt_node *node, const char *name, const u32 *cells, ULONG count)
+{
+	struct host_dt_prop *p = host_dt_find_property(node, (CONST_STRPTR)name);
+	if (p == NULL)
+	{
+		HOST_CHECK(host_dt_prop_count < HOST_DT_MAX_PROPS && strlen(name) < sizeof(p->name));
+		p = &host_dt_props[host_dt_prop_count++];
+		p->node = node;
+		strcpy(p->name, name);
+	}
+	HOST_CHECK(count <= HOST_DT_MAX_CELLS);
+	memcpy(p->cells, cells, count * sizeof(u32));
+	p->len = count * sizeof(u32);
+}
+
+void host_dt_memory(ULONG base, ULONG size)
+{
+	struct host_dt_node *root = host_dt_node(NULL, "");
+	const u32 two = 2, one = 1;
+	const u32 reg[3] = { 0, (u32)base, (u32)size };
+
+	host_dt_prop(root, "#address-cells", &two, 1);
+	host_dt_prop(root, "#size-cells", &one, 1);
+	host_dt_prop(host_dt_node(root, "memory"), "reg", reg, 3);
+}
+
+APTR host_dt_open_key(CONST_STRPTR path)
+{
+	const char *s = (const char *)path;
+	struct host_dt_node *n = &host_dt_nodes[0];
+
+	if (s == NULL || *s != '/')
+		return NULL;
+
+	while (*s != '\0')
+	{
+		while (*s == '/')
+			s++;
+		if (*s == '\0')
+			break;
+
+		size_t len = strcspn(s, "/");
+		n = host_dt_lookup_child(n, s, len);
+		if (n == NULL)
+			return NULL;
+		s += len;
+	}
+	return n;
+}
+
+APTR host_dt_find_property(APTR key, CONST_STRPTR name)
+{
+	if (key == NULL)
+		return NULL;
+
+	for (ULONG i = 0; i < host_dt_prop_count; i++)
+	{
+		if (host_dt_props[i].node == key && strcmp(host_dt_props[i].name, (const char *)name) == 0)
+			return &host_dt_props[i];
+	}
+	return NULL;
+}
+
+const void *host_dt_get_prop_value(APTR prop)
+{
+	return prop ? ((struct host_dt_prop *)prop)->cells : NULL;
+}
+
+ULONG host_dt_get_prop_len(APTR prop)
+{
+	return prop ? ((struct host_dt_prop *)prop)->len : 0;
+}
+
+APTR host_dt_get_parent(APTR key)
+{
+	return key ? ((struct host_dt_node *)key)->parent : NULL;
+}
+
+APTR host_dt_get_child(APTR key, APTR prev)
+{
+	ULONG i = prev ? (ULONG)((struct host_dt_node *)prev - host_dt_nodes) + 1 : 1;
+
+	for (; i < host_dt_node_count; i++)
+	{
+		if (host_dt_nodes[i].parent == key)
+			return &host_dt_nodes[i];
+	}
+	return NULL;
+}
+
+CONST_STRPTR host_dt_get_key_name(APTR key)
+{
+	return key ? (CONST_STRPTR)((struct host_dt_node *)key)->name : NULL;
+}
+
+/* --- Fixtures ---------------------------------------------------------------- */
+
+struct dma_pool *host_dma_pool(struct MemHeader *mh, struct dma_mem_ctx *ctx, ULONG base, ULONG size)
+{
+	host_exec_init();
+	host_dt_memory(base, size);
+	host_add_header(mh, base, size, MEMF_FAST | MEMF_PUBLIC);
+	dma_mem_init(ctx);
+	struct dma_pool *pool = dma_pool_create(ctx);
+	HOST_CHECK(pool != NULL);
+	return pool;
+}
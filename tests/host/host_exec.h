@@ -0,0 +1,76 @@
+/* SPDX-License-Identifier: MPL-2.0 OR GPL-2.0+ */
+#ifndef HOST_EXEC_H
+#define HOST_EXEC_H
+
+/*
+ * Host (Linux) stand-in for the parts of Exec and devicetree.resource the library
+ * calls, so its C sources can be compiled and exercised by ordinary host programs.
+ * Exec memory is real: host_ram() maps a fixed range below 2 GB, and MemHeaders
+ * added over it with host_add_header() are served by a first-fit Allocate() /
+ * Deallocate() / AllocAbs() like Exec's.  Forbid()/Disable() take one recursive
+ * mutex and a SignalSemaphore is a recursive mutex, so threads can stand in for
+ * tasks.  Host ULONG is 64-bit; addresses handed out stay below 2 GB.
+ */
+
+#include <exec/execbase.h>
+#include <proto/exec.h>
+#include <types.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+extern struct ExecBase *SysBase;
+
+/* Empty MemList and device tree; call first, and again to start a new layout. */
+void host_exec_init(void);
+
+/* Map [base, base + size) (page multiples) read/write; aborts if it is taken. */
+void *host_ram(ULONG base, ULONG size);
+void host_ram_free(ULONG base, ULONG size);
+
+/* Add [lower, lower + size) as a MemHeader at the tail of SysBase->MemList. */
+void host_add_header(struct MemHeader *mh, ULONG lower, ULONG size, UWORD attributes);
+
+/* Device tree: host_dt_node(NULL, "") is the root.  Property cells are stored in
+ * host order, which is what DT_GetNumber() reads on the target too. */
+struct host_dt_node;
+struct host_dt_node *host_dt_node(struct host_dt_node *parent, const char *name);
+void host_dt_prop(struct host_dt_node *node, const char *name, const u32 *cells, ULONG count);
+
+/* Root #address-cells 2 / #size-cells 1 and a single-window /memory node. */
+void host_dt_memory(ULONG base, ULONG size);
+
+/* CachePreDMA / CachePostDMA calls since host_exec_init(). */
+extern ULONG host_cache_pre_calls;
+extern ULONG host_cache_post_calls;
+
+/* ObtainSemaphore() calls since host_exec_init(). */
+extern ULONG host_semaphore_obtains;
+
+/* Kprintf lines since host_exec_init() / host_kprintf_reset(), and the last one.
+ * Set HOST_KPRINTF in the environment to also echo them to stderr. */
+extern ULONG host_kprintf_count;
+extern char host_kprintf_last[256];
+void host_kprintf_reset(void);
+
+/* The single-header layout most tests run on: a fresh host_exec_init(), a /memory
+ * node and one Emu68 header @mh over [base, base + size) (already host_ram()'d),
+ * dma_mem_init(@ctx) and a default pool on it. */
+struct dma_mem_ctx;
+struct dma_pool;
+struct dma_pool *host_dma_pool(struct MemHeader *mh, struct dma_mem_ctx *ctx, ULONG base, ULONG size);
+
+/* Monotonic nanoseconds, for the benchmarks. */
+u64 host_now_ns(void);
+
+#define HOST_CHECK(cond)                                                          \
+	do                                                                            \
+	{                                                                             \
+		if (!(cond))                                                              \
+		{                                                                         \
+			fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+			exit(1);                                                              \
+		}                                                                         \
+	} while (0)
+
+#endif
@@ -0,0 +1,2 @@
+/* SPDX-License-Identifier: MPL-2.0 OR GPL-2.0+ */
+#include <proto/exec.h>
@@ -0,0 +1,16 @@
+/* SPDX-License-Identifier: MPL-2.0 OR GPL-2.0+ */
+#ifndef __DEBUG_H
+#define __DEBUG_H
+
+/*
+ * Host stand-in for debug.h: Kprintf lines go to host_kprintf(), which counts them
+ * and keeps the last one (see host_exec.h), so tests can check what the library
+ * reported.  KprintfH stays compiled out, as in a normal debug build.
+ */
+void host_kprintf(const char *fmt, ...);
+
+#define Kprintf(...) host_kprintf(__VA_ARGS__)
+#define KprintfH(...) ((void)0)
+#define KASSERT(cond, msg) do { if (!(cond)) host_kprintf("[kassert] " msg "\n"); } while (0)
+
+#endif
@@ -0,0 +1,12 @@
+/* SPDX-License-Identifier: MPL-2.0 OR GPL-2.0+ */
+#ifndef EXEC_EXECBASE_H
+#define EXEC_EXECBASE_H
+
+#include <exec/lists.h>
+
+struct ExecBase
+{
+	struct List MemList;
+};
+
+#endif
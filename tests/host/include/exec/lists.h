@@ -0,0 +1,19 @@
+/* SPDX-License-Identifier: MPL-2.0 OR GPL-2.0+ */
+#ifndef EXEC_LISTS_H
+#define EXEC_LISTS_H
+
+#include <exec/nodes.h>
+
+struct List
+{
+	struct Node *lh_Head, *lh_Tail, *lh_TailPred;
+	UBYTE lh_Type;
+	UBYTE l_pad;
+};
+
+struct MinList
+{
+	struct MinNode *mlh_Head, *mlh_Tail, *mlh_TailPred;
+};
+
+#endif
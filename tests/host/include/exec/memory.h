@@ -0,0 +1,29 @@
+/* SPDX-License-Identifier: MPL-2.0 OR GPL-2.0+ */
+#ifndef EXEC_MEMORY_H
+#define EXEC_MEMORY_H
+
+#include <exec/nodes.h>
+
+struct MemChunk
+{
+	struct MemChunk *mc_Next;
+	ULONG mc_Bytes;
+};
+
+struct MemHeader
+{
+	struct Node mh_Node;
+	UWORD mh_Attributes;
+	struct MemChunk *mh_First;
+	APTR mh_Lower, mh_Upper;
+	ULONG mh_Free;
+};
+
+#define MEM_BLOCKSIZE 16UL
+
+#define MEMF_PUBLIC (1UL << 0)
+#define MEMF_CHIP (1UL << 1)
+#define MEMF_FAST (1UL << 2)
+#define MEMF_CLEAR (1UL << 16)
+
+#endif
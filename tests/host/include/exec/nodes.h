@@ -0,0 +1,22 @@
+/* SPDX-License-Identifier: MPL-2.0 OR GPL-2.0+ */
+#ifndef EXEC_NODES_H
+#define EXEC_NODES_H
+
+#include <exec/types.h>
+
+struct Node
+{
+	struct Node *ln_Succ, *ln_Pred;
+	UBYTE ln_Type;
+	BYTE ln_Pri;
+	char *ln_Name;
+};
+
+struct MinNode
+{
+	struct MinNode *mln_Succ, *mln_Pred;
+};
+
+#define NT_SIGNALSEM 15
+
+#endif
@@ -0,0 +1,15 @@
+/* SPDX-License-Identifier: MPL-2.0 OR GPL-2.0+ */
+/* Host stand-in: a SignalSemaphore is a recursive pthread mutex, so the concurrent
+ * pool tests run real threads as "tasks". */
+#ifndef EXEC_SEMAPHORES_H
+#define EXEC_SEMAPHORES_H
+
+#include <pthread.h>
+#include <exec/lists.h>
+
+struct SignalSemaphore
+{
+	pthread_mutex_t ss_HostMutex;
+};
+
+#endif
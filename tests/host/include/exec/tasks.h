@@ -0,0 +1,12 @@
+/* SPDX-License-Identifier: MPL-2.0 OR GPL-2.0+ */
+#ifndef EXEC_TASKS_H
+#define EXEC_TASKS_H
+
+#include <exec/nodes.h>
+
+struct Task
+{
+	struct Node tc_Node;
+};
+
+#endif
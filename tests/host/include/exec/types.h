@@ -0,0 +1,24 @@
+/* SPDX-License-Identifier: MPL-2.0 OR GPL-2.0+ */
+/* Host test stand-in for the NDK header: only what the library uses. */
+#ifndef EXEC_TYPES_H
+#define EXEC_TYPES_H
+
+typedef unsigned long ULONG; /* wide enough for a host pointer */
+typedef long LONG;
+typedef unsigned short UWORD;
+typedef short WORD;
+typedef unsigned char UBYTE;
+typedef signed char BYTE;
+typedef short BOOL;
+typedef void *APTR;
+typedef void VOID;
+typedef unsigned char *STRPTR;
+typedef const unsigned char *CONST_STRPTR;
+
+#define TRUE 1
+#define FALSE 0
+#ifndef NULL
+#define NULL ((void *)0)
+#endif
+
+#endif
@@ -0,0 +1,27 @@
+/* SPDX-License-Identifier: MPL-2.0 OR GPL-2.0+ */
+/* Host stand-in for devicetree.resource.  The tree is whatever the test built with
+ * host_dt_node() / host_dt_prop(); the macros keep the callers' DeviceTreeBase used
+ * the way the NDK inlines do. */
+#ifndef PROTO_DEVICETREE_H
+#define PROTO_DEVICETREE_H
+
+#include <exec/types.h>
+
+APTR host_dt_open_key(CONST_STRPTR path);
+APTR host_dt_find_property(APTR key, CONST_STRPTR name);
+const void *host_dt_get_prop_value(APTR prop);
+ULONG host_dt_get_prop_len(APTR prop);
+APTR host_dt_get_parent(APTR key);
+APTR host_dt_get_child(APTR key, APTR prev);
+CONST_STRPTR host_dt_get_key_name(APTR key);
+
+#define DT_OpenKey(path)         ((void)DeviceTreeBase, host_dt_open_key(path))
+#define DT_CloseKey(key)         ((void)DeviceTreeBase, (void)(key))
+#define DT_FindProperty(key, n)  ((void)DeviceTreeBase, host_dt_find_property(key, n))
+#define DT_GetPropValue(prop)    ((void)DeviceTreeBase, host_dt_get_prop_value(prop))
+#define DT_GetPropLen(prop)      ((void)DeviceTreeBase, host_dt_get_prop_len(prop))
+#define DT_GetParent(key)        ((void)DeviceTreeBase, host_dt_get_parent(key))
+#define DT_GetChild(key, prev)   ((void)DeviceTreeBase, host_dt_get_child(key, prev))
+#define DT_GetKeyName(key)       ((void)DeviceTreeBase, host_dt_get_key_name(key))
+
+#endif
@@ -0,0 +1,40 @@
+/* SPDX-License-Identifier: MPL-2.0 OR GPL-2.0+ */
+/* Host stand-in for the Exec calls the library makes; implemented in host_exec.c. */
+#ifndef PROTO_EXEC_H
+#define PROTO_EXEC_H
+
+#include <exec/types.h>
+#include <exec/memory.h>
+#include <exec/lists.h>
+#include <exec/semaphores.h>
+
+struct ExecBase;
+
+APTR Allocate(struct MemHeader *mh, ULONG size);
+void Deallocate(struct MemHeader *mh, APTR block, ULONG size);
+APTR AllocAbs(ULONG size, APTR location);
+APTR AllocMem(ULONG size, ULONG flags);
+void FreeMem(APTR block, ULONG size);
+APTR AllocPooled(APTR pool, ULONG size);
+void FreePooled(APTR pool, APTR block, ULONG size);
+void CopyMem(const void *src, void *dst, ULONG size);
+void Forbid(void);
+void Permit(void);
+void Disable(void);
+void Enable(void);
+void AddHead(struct List *list, struct Node *node);
+void AddTail(struct List *list, struct Node *node);
+void Remove(struct Node *node);
+struct Node *RemHead(struct List *list);
+void InitSemaphore(struct SignalSemaphore *sem);
+void ObtainSemaphore(struct SignalSemaphore *sem);
+void ReleaseSemaphore(struct SignalSemaphore *sem);
+APTR OpenResource(CONST_STRPTR name);
+APTR CachePreDMA(APTR addr, ULONG *len, ULONG flags);
+void CachePostDMA(APTR addr, ULONG *len, ULONG flags);
+
+#define DMA_Continue (1UL << 1)
+#define DMA_NoModify (1UL << 2)
+#define DMA_ReadFromRAM (1UL << 3)
+
+#endif
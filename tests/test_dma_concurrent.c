@@ -0,0 +1,258 @@
+/* SPDX-License-Identifier: MPL-2.0 OR GPL-2.0+ */
+/*
+ * Concurrent-mode stress: threads stand in for the unit tasks of one driver and
+ * share a single dma_pool.  Each runs a random mix of per-task magazine
+ * (dma_cache_alloc / dma_cache_free) traffic, locked dma_alloc / dma_alloc_oob calls
+ * and bounce dma_map / dma_unmap round trips, with a task-unique fill checked before
+ * every free or unmap.  Half the dma_alloc() blocks go back through the freeing
+ * task's magazine.  Two tasks ever holding the same bytes shows up as a fill
+ * mismatch.  One task also trims and changes the spare setting while the others
+ * run.  A second phase has every task do nothing but bounce round trips, so the
+ * slot list sees pops and pushes from several tasks at once.  Last, a warm magazine
+ * must serve every class size without taking the pool semaphore.
+ */
+
+#include "host_exec.h"
+
+#include <dma_mem.h>
+#include <pthread.h>
+#include <string.h>
+
+#define RAM_BASE   0x28000000UL
+#define RAM_SIZE   (64UL << 20)
+#define PUDDLE     (128UL * 1024UL)
+#define TASKS      6
+#define LIVE       48
+#define ITERATIONS 40000
+#define SLOTS      4
+#define SLOT_SIZE  2048
+#define BOUNCES    1000000
+
+enum kind
+{
+	KIND_CACHE,
+	KIND_ALLOC,
+	KIND_OOB,
+};
+
+struct block
+{
+	UBYTE *ptr;
+	ULONG size;
+	enum kind kind;
+	UBYTE fill;
+};
+
+struct task
+{
+	pthread_t thread;
+	ULONG id;
+	unsigned int seed;
+	struct dma_pool_cache cache;
+	struct block live[LIVE];
+	ULONG maps;
+};
+
+static struct MemHeader mh;
+static struct dma_mem_ctx ctx;
+static struct dma_pool *pool;
+
+static void check_fill(const UBYTE *p, ULONG size, UBYTE fill)
+{
+	for (ULONG i = 0; i < size; i++)
+		HOST_CHECK(p[i] == fill);
+}
+
+static void block_free(struct task *t, struct block *b)
+{
+	check_fill(b->ptr, b->size, b->fill);
+	memset(b->ptr, 0xee, b->size);
+	if (b->kind == KIND_CACHE || (b->kind == KIND_ALLOC && (b->fill & 1)))
+		dma_cache_free(&t->cache, b->ptr);
+	else if (b->kind == KIND_ALLOC)
+		dma_free(pool, b->ptr);
+	else
+		dma_free_oob(pool, b->ptr);
+	b->ptr = NULL;
+}
+
+static void block_alloc(struct task *t, struct block *b)
+{
+	ULONG pick = (ULONG)rand_r(&t->seed);
+
+	b->kind = (enum kind)(pick % 3);
+	if (b->kind == KIND_CACHE)
+	{
+		/* 16 B .. 32 KB: every class, and the header path above 16 KB */
+		b->size = (16UL << ((pick >> 4) % 12)) - (pick >> 12) % 16;
+		b->ptr = dma_cache_alloc(&t->cache, 64, b->size);
+	}
+	else if (b->kind == KIND_ALLOC)
+	{
+		b->size = 16 + (pick >> 4) % 3000;
+		b->ptr = dma_alloc(pool, 64, b->size);
+	}
+	else
+	{
+		b->size = 64 + (pick >> 4) % 2000;
+		b->ptr = dma_alloc_oob(pool, 64, b->size);
+	}
+	HOST_CHECK(b->ptr != NULL);
+	HOST_CHECK(dma_addr_reachable(&ctx, b->ptr, b->size));
+	b->fill = (UBYTE)(t->id * 37 + (pick >> 8));
+	memset(b->ptr, b->fill, b->size);
+}
+
+/* Bounce a host (unreachable) buffer both ways and check the copy back. */
+static void bounce_round_trip(struct task *t)
+{
+	UBYTE buf[SLOT_SIZE];
+	struct dma_map map;
+	ULONG len = 1 + (ULONG)rand_r(&t->seed) % SLOT_SIZE;
+	UBYTE fill = (UBYTE)(t->id + 1);
+
+	memset(buf, fill, len);
+	if (!dma_map(pool, &map, buf, len, DMA_BIDIRECTIONAL))
+		return; /* every slot in use by other tasks */
+
+	HOST_CHECK(map.slot != NULL && map.dma != buf);
+	check_fill(map.dma, len, fill);
+	memset(map.dma, (UBYTE)~fill, len); /* the "device" answers */
+	check_fill(map.dma, len, (UBYTE)~fill);
+	dma_unmap(pool, &map);
+	check_fill(buf, len, (UBYTE)~fill);
+	t->maps++;
+}
+
+static void *bounce_main(void *arg)
+{
+	struct task *t = arg;
+
+	for (ULONG i = 0; i < BOUNCES; i++)
+		bounce_round_trip(t);
+	return NULL;
+}
+
+static void run_tasks(struct task *tasks, void *(*fn)(void *))
+{
+	for (ULONG i = 0; i < TASKS; i++)
+		HOST_CHECK(pthread_create(&tasks[i].thread, NULL, fn, &tasks[i]) == 0);
+	for (ULONG i = 0; i < TASKS; i++)
+		pthread_join(tasks[i].thread, NULL);
+}
+
+static void *task_main(void *arg)
+{
+	struct task *t = arg;
+
+	dma_pool_cache_init(&t->cache, pool);
+	for (ULONG i = 0; i < ITERATIONS; i++)
+	{
+		ULONG pick = (ULONG)rand_r(&t->seed);
+		struct block *b = &t->live[pick % LIVE];
+
+		if ((pick >> 8) % 8 == 0)
+			bounce_round_trip(t);
+		else if (b->ptr)
+			block_free(t, b);
+		else
+			block_alloc(t, b);
+
+		if (t->id == 0 && i % 5000 == 4999)
+		{
+			dma_pool_trim(pool);
+			dma_pool_set_spare(pool, (i / 5000) % 3);
+		}
+	}
+
+	for (ULONG i = 0; i < LIVE; i++)
+	{
+		if (t->live[i].ptr)
+			block_free(t, &t->live[i]);
+	}
+	dma_pool_cache_flush(&t->cache);
+	return NULL;
+}
+
+/* Once warm, alloc/free pairs of every class stay in the magazine, lock-free. */
+static void check_magazine(void)
+{
+	static struct dma_pool_cache cache;
+	ULONG obtains;
+
+	dma_pool_cache_init(&cache, pool);
+	for (int pass = 0; pass < 2; pass++)
+	{
+		obtains = host_semaphore_obtains;
+		for (ULONG size = 16; size <= DMA_ALLOC_CLASS_MAX; size <<= 1)
+		{
+			for (ULONG i = 0; i < 100; i++)
+			{
+				UBYTE *p = dma_cache_alloc(&cache, 64, size);
+				HOST_CHECK(p != NULL && ((ULONG)p & 63) == 0);
+				memset(p, 0x5a, size);
+				dma_cache_free(&cache, p);
+			}
+		}
+	}
+	HOST_CHECK(host_semaphore_obtains == obtains);
+	for (ULONG c = 0; c < DMA_POOL_CACHE_CLASSES; c++)
+		HOST_CHECK(cache.count[c] != 0);
+	dma_pool_cache_flush(&cache);
+	for (ULONG c = 0; c < DMA_POOL_CACHE_CLASSES; c++)
+		HOST_CHECK(cache.count[c] == 0);
+}
+
+int main(void)
+{
+	static struct task tasks[TASKS];
+	struct dma_map maps[SLOTS + 1];
+	static UBYTE host_buf[SLOT_SIZE];
+	ULONG maps_done = 0;
+
+	host_ram(RAM_BASE, RAM_SIZE);
+	pool = host_dma_pool(&mh, &ctx, RAM_BASE, RAM_SIZE);
+	dma_pool_enable_concurrent(pool);
+	HOST_CHECK(dma_pool_bounce_init(pool, SLOTS, SLOT_SIZE));
+
+	for (ULONG i = 0; i < TASKS; i++)
+	{
+		tasks[i].id = i;
+		tasks[i].seed = 11 + (unsigned int)i;
+	}
+	run_tasks(tasks, task_main);
+	run_tasks(tasks, bounce_main);
+	for (ULONG i = 0; i < TASKS; i++)
+		maps_done += tasks[i].maps;
+	HOST_CHECK(maps_done > 0);
+	check_magazine();
+
+	/* Every bounce slot came back exactly once. */
+	for (ULONG i = 0; i < SLOTS; i++)
+		HOST_CHECK(dma_map(pool, &maps[i], host_buf, 64, DMA_FROM_DEVICE) && maps[i].slot);
+	HOST_CHECK(!dma_map(pool, &maps[SLOTS], host_buf, 64, DMA_FROM_DEVICE));
+	for (ULONG i = 0; i < SLOTS; i++)
+	{
+		for (ULONG j = 0; j < i; j++)
+			HOST_CHECK(maps[i].slot != maps[j].slot);
+		dma_unmap(pool, &maps[i]);
+	}
+
+	/* Everything was freed: only the bounce block and the spare puddles remain. */
+	dma_pool_set_spare(pool, 1);
+	dma_pool_trim(pool);
+	HOST_CHECK(RAM_SIZE - mh.mh_Free <= 2 * PUDDLE);
+
+	/* A reservation from one task is consistent for the others. */
+	HOST_CHECK(dma_pool_reserve(pool, 4 * PUDDLE, 0));
+	HOST_CHECK(!dma_pool_refill_pending(pool));
+	HOST_CHECK(dma_pool_reserve(pool, 0, 0));
+
+	dma_pool_delete(pool);
+	HOST_CHECK(mh.mh_Free == RAM_SIZE);
+	dma_mem_exit(&ctx);
+
+	printf("test_dma_concurrent: %d tasks x %d operations, %lu bounce round trips ok\n", TASKS,
+		   ITERATIONS, maps_done);
+	return 0;
+}
@@ -0,0 +1,155 @@
+/* SPDX-License-Identifier: MPL-2.0 OR GPL-2.0+ */
+/*
+ * dma_mem_init() on boards with more Emu68 headers than fit inline: 20 headers
+ * from split windows (adjacent pieces) and removed sub-ranges (holes between
+ * pieces), listed out of order.  Every header is found, touching pieces merge,
+ * holes stay unreachable, and the heap tables feed dma_sg_build(), the arena
+ * allocator and limited pools.  A small board stays inline, and a context can be
+ * copied.
+ */
+
+#include "host_exec.h"
+
+#include <dma_mem.h>
+#include <string.h>
+
+#define RAM_BASE 0x40000000UL
+#define RAM_SIZE (64UL << 20)
+#define PIECE    (2UL << 20)
+#define HEADERS  20
+
+static struct MemHeader mh[HEADERS];
+static ULONG start[HEADERS];
+
+/* Pieces of PIECE bytes from RAM_BASE up.  A 1 MB sub-range was removed after
+ * every @hole_every-th piece; elsewhere the next piece touches it. */
+static void make_board(ULONG hole_every)
+{
+	ULONG cur = RAM_BASE;
+
+	host_exec_init();
+	host_dt_memory(RAM_BASE, RAM_SIZE);
+	for (ULONG i = 0; i < HEADERS; i++)
+	{
+		start[i] = cur;
+		cur += PIECE;
+		if (i % hole_every == hole_every - 1)
+			cur += 1UL << 20;
+	}
+	HOST_CHECK(cur <= RAM_BASE + RAM_SIZE);
+
+	/* Odd pieces first, then even ones: Exec lists them in priority order, not by
+	 * address. */
+	for (ULONG i = 1; i < HEADERS; i += 2)
+		host_add_header(&mh[i], start[i], PIECE, MEMF_FAST | MEMF_PUBLIC);
+	for (ULONG i = 0; i < HEADERS; i += 2)
+		host_add_header(&mh[i], start[i], PIECE, MEMF_FAST | MEMF_PUBLIC);
+}
+
+static void check_board(struct dma_mem_ctx *ctx, ULONG hole_every)
+{
+	struct dma_sg_seg seg[4];
+
+	HOST_CHECK(ctx->count == HEADERS && ctx->capacity >= HEADERS && ctx->heap != NULL);
+	HOST_CHECK(ctx->range_count == (HEADERS + hole_every - 1) / hole_every);
+
+	for (ULONG i = 0; i < HEADERS; i++)
+	{
+		ULONG end = start[i] + PIECE;
+		HOST_CHECK(dma_addr_reachable(ctx, (APTR)start[i], PIECE));
+		if (i + 1 == HEADERS)
+			break;
+		if (i % hole_every != hole_every - 1)
+		{
+			/* Split: a buffer straddling the two pieces is reachable. */
+			HOST_CHECK(dma_addr_reachable(ctx, (APTR)(end - 64), 128));
+			HOST_CHECK(dma_sg_build(ctx, (APTR)(end - 64), 128, seg, 4) == 1 && seg[0].reachable);
+		}
+		else
+		{
+			/* Removed: the hole is not, and an sg split goes around it. */
+			HOST_CHECK(!dma_addr_reachable(ctx, (APTR)(end - 64), 128));
+			HOST_CHECK(!dma_addr_reachable(ctx, (APTR)(end + 4096), 64));
+			HOST_CHECK(dma_sg_build(ctx, (APTR)(end - 64), (1UL << 20) + 128, seg, 4) == 3);
+			HOST_CHECK(seg[0].reachable && seg[0].len == 64);
+			HOST_CHECK(!seg[1].reachable && seg[1].len == 1UL << 20);
+			HOST_CHECK(seg[2].reachable && seg[2].len == 64 && (ULONG)seg[2].addr == start[i + 1]);
+		}
+	}
+	HOST_CHECK(!dma_addr_reachable(ctx, (APTR)(start[HEADERS - 1] + PIECE), 64));
+}
+
+static void test_large(ULONG hole_every)
+{
+	static struct dma_mem_ctx ctx;
+
+	make_board(hole_every);
+	memset(&ctx, 0xa5, sizeof(ctx));
+	dma_mem_init(&ctx);
+	check_board(&ctx, hole_every);
+
+	/* Headers past the inline capacity serve arenas and limited pools. */
+	ULONG last = start[HEADERS - 1];
+	APTR src;
+	APTR arena = dma_mem_arena_alloc_window(&ctx, 4096, 4096, last, last + PIECE - 1, &src);
+	HOST_CHECK(arena != NULL && src == &mh[HEADERS - 1] && (ULONG)arena >= last);
+	dma_mem_arena_free(src, arena, 4096);
+
+	struct dma_pool *pool = dma_pool_create_limited(&ctx, last, 0xffffffffUL);
+	HOST_CHECK(pool != NULL);
+	APTR p = dma_alloc(pool, 64, 1000);
+	HOST_CHECK(p != NULL && (ULONG)p >= last && dma_addr_reachable(&ctx, p, 1000));
+	dma_free(pool, p);
+	dma_pool_delete(pool);
+
+	/* A copy reads the same (shared) heap tables. */
+	static struct dma_mem_ctx copy;
+	copy = ctx;
+	check_board(&copy, hole_every);
+
+	dma_mem_exit(&ctx);
+	HOST_CHECK(ctx.count == 0 && ctx.heap == NULL && ctx.capacity == DMA_MEM_MAX_REGIONS);
+	HOST_CHECK(!dma_addr_reachable(&ctx, (APTR)0x1000UL, 16));
+}
+
+/* A board that fits inline needs no heap, and a copy stays valid after the
+ * original is gone. */
+static void test_small_copy(void)
+{
+	static struct dma_mem_ctx ctx, copy;
+
+	host_exec_init();
+	host_dt_memory(RAM_BASE, RAM_SIZE);
+	host_add_header(&mh[0], RAM_BASE + PIECE, PIECE, MEMF_FAST | MEMF_PUBLIC);
+	host_add_header(&mh[1], RAM_BASE, PIECE, MEMF_FAST | MEMF_PUBLIC);
+	dma_mem_init(&ctx);
+	HOST_CHECK(ctx.count == 2 && ctx.range_count == 1 && ctx.heap == NULL);
+	HOST_CHECK(dma_mem_regions(&ctx) == ctx.regions && dma_mem_ranges(&ctx) == ctx.ranges);
+
+	copy = ctx;
+	memset(&ctx, 0xa5, sizeof(ctx));
+	HOST_CHECK(dma_mem_ranges(&copy) == copy.ranges);
+	HOST_CHECK(dma_addr_reachable(&copy, (APTR)(RAM_BASE + PIECE - 64), 128));
+	HOST_CHECK(!dma_addr_reachable(&copy, (APTR)(RAM_BASE + 2 * PIECE), 64));
+
+	struct dma_pool *pool = dma_pool_create(&copy);
+	HOST_CHECK(pool != NULL);
+	APTR p = dma_alloc(pool, 64, 1000);
+	HOST_CHECK(p != NULL && dma_addr_reachable(&copy, p, 1000));
+	dma_free(pool, p);
+	dma_pool_delete(pool);
+	dma_mem_exit(&copy);
+}
+
+int main(void)
+{
+	host_ram(RAM_BASE, RAM_SIZE);
+
+	test_large(HEADERS); /* split only: one range */
+	test_large(3);		 /* removed sub-ranges every third piece */
+	test_large(1);		 /* every piece on its own */
+	test_small_copy();
+
+	printf("test_dma_mem_init: ok\n");
+	return 0;
+}
@@ -0,0 +1,254 @@
+/* SPDX-License-Identifier: MPL-2.0 OR GPL-2.0+ */
+/*
+ * Region pool: raw requests use the size-class lists only at exact class sizes,
+ * dma_alloc() rounds its payload up to a naturally aligned class block with no
+ * header (and keeps the header path above 16 KB), and puddles go back to Emu68 RAM
+ * after a burst even though the class caches saw the frees (on a reserved pool only
+ * at the next refill or trim).
+ */
+
+#include "host_exec.h"
+
+#include <dma_mem.h>
+#include <bits.h>
+#include <string.h>
+
+#define RAM_BASE 0x20000000UL
+#define RAM_SIZE (32UL << 20)
+#define PUDDLE   (128UL * 1024UL)
+#define BURST    3000
+#define BUFS     2000
+
+static struct MemHeader mh;
+static struct dma_mem_ctx ctx;
+
+static ULONG ram_taken(void)
+{
+	return RAM_SIZE - mh.mh_Free;
+}
+
+static struct dma_pool *fresh_pool(void)
+{
+	return host_dma_pool(&mh, &ctx, RAM_BASE, RAM_SIZE);
+}
+
+static void test_exact_classes(void)
+{
+	struct dma_pool *pool = fresh_pool();
+	APTR keep = dma_pool_region_alloc(pool, 64);
+
+	/* A class size comes back from its free list. */
+	APTR a = dma_pool_region_alloc(pool, 4096);
+	dma_pool_region_free(pool, a, 4096);
+	HOST_CHECK(dma_pool_region_alloc(pool, 4096) == a);
+
+	/* An odd size is carved at its real size, not a class up. */
+	UBYTE *b = dma_pool_region_alloc(pool, 4096 + 75);
+	UBYTE *c = dma_pool_region_alloc(pool, 4096 + 75);
+	HOST_CHECK(b && c && c - b == (LONG)ALIGN_UP(4096 + 75, MEM_BLOCKSIZE));
+
+	/* dma_alloc(64, 4096) is one 4 KB class block aligned to 4 KB, with no header
+	 * or slack, and a freed one comes straight back from the class list. */
+	UBYTE *d = dma_alloc(pool, 64, 4096);
+	UBYTE *e = dma_alloc(pool, 64, 4096);
+	HOST_CHECK(d && e && ((ULONG)d & 4095) == 0 && ((ULONG)e & 4095) == 0);
+	dma_free(pool, e);
+	HOST_CHECK(dma_alloc(pool, 64, 3000) == e);
+
+	dma_free(pool, e);
+	dma_free(pool, d);
+	dma_pool_region_free(pool, c, 4096 + 75);
+	dma_pool_region_free(pool, b, 4096 + 75);
+	dma_pool_region_free(pool, a, 4096);
+	dma_pool_region_free(pool, keep, 64);
+	HOST_CHECK(ram_taken() <= PUDDLE);
+	dma_pool_delete(pool);
+	dma_mem_exit(&ctx);
+}
+
+/* A burst of class-sized blocks over several puddles, freed in random order without
+ * dma_pool_trim(): only the spare puddles may stay. */
+static void test_burst_release(ULONG spare)
+{
+	static APTR blk[BURST];
+	static ULONG size[BURST];
+	struct dma_pool *pool = fresh_pool();
+
+	dma_pool_set_spare(pool, spare);
+	for (ULONG i = 0; i < BURST; i++)
+	{
+		size[i] = 64UL << ((ULONG)rand() % 4);
+		blk[i] = dma_pool_region_alloc(pool, size[i]);
+		HOST_CHECK(blk[i] != NULL);
+	}
+	HOST_CHECK(ram_taken() > 4 * PUDDLE);
+
+	for (ULONG i = 0; i + 1 < BURST; i++)
+	{
+		ULONG j = i + (ULONG)rand() % (BURST - i);
+		APTR p = blk[i];
+		ULONG s = size[i];
+		blk[i] = blk[j];
+		size[i] = size[j];
+		blk[j] = p;
+		size[j] = s;
+	}
+	for (ULONG i = 0; i < BURST; i++)
+		dma_pool_region_free_owned(pool, blk[i], size[i], NULL);
+
+	HOST_CHECK(ram_taken() <= spare * PUDDLE);
+
+	/* The pool still works, and a steady same-class load recycles through the class
+	 * cache while another block keeps the puddle alive. */
+	APTR keep = dma_pool_region_alloc(pool, 512);
+	APTR a = dma_pool_region_alloc(pool, 256);
+	dma_pool_region_free(pool, a, 256);
+	HOST_CHECK(dma_pool_region_alloc(pool, 256) == a);
+	dma_pool_region_free(pool, a, 256);
+	dma_pool_region_free(pool, keep, 512);
+	HOST_CHECK(ram_taken() <= spare * PUDDLE);
+
+	dma_pool_delete(pool);
+	HOST_CHECK(ram_taken() == 0);
+	dma_mem_exit(&ctx);
+}
+
+static void test_trim(void)
+{
+	struct dma_pool *pool = fresh_pool();
+	APTR keep = dma_pool_region_alloc(pool, 1000);
+	APTR a[16];
+
+	for (int i = 0; i < 16; i++)
+		a[i] = dma_pool_region_alloc(pool, 1024);
+	for (int i = 0; i < 16; i++)
+		dma_pool_region_free(pool, a[i], 1024);
+
+	/* The cached blocks are handed back and coalesce with the alignment slack in
+	 * front of the first: first fit lands right after @keep. */
+	dma_pool_trim(pool);
+	APTR big = dma_pool_region_alloc(pool, 16 * 1024 + 16);
+	HOST_CHECK(big == (UBYTE *)keep + ALIGN_UP(1000, MEM_BLOCKSIZE) &&
+			   (ULONG)a[0] - (ULONG)big < 1024);
+	HOST_CHECK(ram_taken() == PUDDLE);
+
+	dma_pool_region_free(pool, big, 16 * 1024 + 16);
+	dma_pool_region_free(pool, keep, 1000);
+	dma_pool_delete(pool);
+	dma_mem_exit(&ctx);
+}
+
+/* A reserved pool's free path releases nothing; the surplus waits for the next
+ * dma_pool_refill() / dma_pool_trim(), which keep the reserve. */
+static void test_reserve_release(void)
+{
+	static APTR blk[BUFS];
+	struct dma_pool *pool = fresh_pool();
+	ULONG n = 0;
+
+	HOST_CHECK(dma_pool_reserve(pool, 4 * PUDDLE, 0));
+	HOST_CHECK(ram_taken() >= 4 * PUDDLE && ram_taken() < 5 * PUDDLE);
+
+	for (int round = 0; round < 2; round++)
+	{
+		while ((blk[n] = dma_pool_region_alloc(pool, 16384)) != NULL)
+			n++;
+		HOST_CHECK(n > 0 && dma_pool_refill_pending(pool));
+		HOST_CHECK(dma_pool_refill(pool) >= 4 * PUDDLE);
+	}
+	ULONG full = ram_taken();
+	HOST_CHECK(full >= 12 * PUDDLE);
+
+	while (n > 0)
+		dma_pool_region_free(pool, blk[--n], 16384);
+	HOST_CHECK(ram_taken() == full && dma_pool_refill_pending(pool));
+	HOST_CHECK(dma_pool_refill(pool) == 0);
+	HOST_CHECK(!dma_pool_refill_pending(pool));
+	HOST_CHECK(ram_taken() >= 4 * PUDDLE && ram_taken() < 5 * PUDDLE);
+
+	/* Same through dma_pool_trim(). */
+	while ((blk[n] = dma_pool_region_alloc(pool, 16384)) != NULL)
+		n++;
+	dma_pool_refill(pool);
+	full = ram_taken();
+	while (n > 0)
+		dma_pool_region_free(pool, blk[--n], 16384);
+	HOST_CHECK(ram_taken() == full);
+	dma_pool_trim(pool);
+	HOST_CHECK(!dma_pool_refill_pending(pool));
+	HOST_CHECK(ram_taken() >= 4 * PUDDLE && ram_taken() < 5 * PUDDLE);
+
+	dma_pool_delete(pool);
+	HOST_CHECK(ram_taken() == 0);
+	dma_mem_exit(&ctx);
+}
+
+/* Random payloads and alignments through dma_alloc() / dma_cache_alloc(), freed
+ * in random order through either: class blocks are aligned to their class and
+ * never overlap, header blocks still work, and the puddles all go back. */
+static void test_dma_alloc(void)
+{
+	static UBYTE *buf[BUFS];
+	static ULONG len[BUFS];
+	static const ULONG aligns[] = { 1, 8, 64, 256, 4096 };
+	struct dma_pool_cache cache;
+	struct dma_pool *pool = fresh_pool();
+
+	dma_pool_cache_init(&cache, pool);
+	for (ULONG i = 0; i < BUFS; i++)
+	{
+		ULONG align = aligns[(ULONG)rand() % 5];
+		len[i] = (ULONG)rand() % 4 == 0 ? 16384 + (ULONG)rand() % 8192 : (ULONG)rand() % 16384;
+		buf[i] = i % 2 ? dma_cache_alloc(&cache, align, len[i]) : dma_alloc(pool, align, len[i]);
+		HOST_CHECK(buf[i] != NULL && ((ULONG)buf[i] & (align - 1)) == 0);
+
+		ULONG cls = dma_alloc_class(align, len[i]);
+		HOST_CHECK((cls != 0) == (len[i] <= 16384 && align <= 16384));
+		HOST_CHECK(cls == 0 || ((ULONG)buf[i] & (cls - 1)) == 0);
+		memset(buf[i], (int)i, len[i]);
+	}
+
+	for (ULONG i = 0; i < BUFS; i++)
+	{
+		ULONG j = (ULONG)rand() % BUFS;
+		UBYTE *p = buf[i];
+		ULONG l = len[i];
+		buf[i] = buf[j];
+		len[i] = len[j];
+		buf[j] = p;
+		len[j] = l;
+	}
+	for (ULONG i = 0; i < BUFS; i++)
+	{
+		UBYTE fill = buf[i][0];
+		for (ULONG b = 0; b < len[i]; b++)
+			HOST_CHECK(buf[i][b] == fill);
+		if (i % 3)
+			dma_free(pool, buf[i]);
+		else
+			dma_cache_free(&cache, buf[i]);
+	}
+	dma_pool_cache_flush(&cache);
+	HOST_CHECK(ram_taken() <= PUDDLE);
+
+	dma_pool_delete(pool);
+	HOST_CHECK(ram_taken() == 0);
+	dma_mem_exit(&ctx);
+}
+
+int main(void)
+{
+	srand(3);
+	host_ram(RAM_BASE, RAM_SIZE);
+
+	test_exact_classes();
+	test_burst_release(1);
+	test_burst_release(0);
+	test_burst_release(2);
+	test_trim();
+	test_reserve_release();
+	test_dma_alloc();
+
+	printf("test_dma_pool: ok\n");
+	return 0;
+}
@@ -0,0 +1,208 @@
+/* SPDX-License-Identifier: MPL-2.0 OR GPL-2.0+ */
+/*
+ * DMA_TRACK ownership tracker: the usual dma_map() + dma_sync_for_device() /
+ * dma_sync_for_cpu() + dma_unmap() sequences report nothing, in place, bounced and
+ * batched (taking back sub-ranges and coalesced batch arrays), while real misuse
+ * still does (double map, stray take-back, CPU write to a device-read buffer, free
+ * while mapped, unaligned device-written sync, device-written buffer sharing a
+ * cache line with another handed-over one).
+ */
+
+#include "host_exec.h"
+
+#include <dma_mem.h>
+#include <string.h>
+
+#define RAM_BASE 0x38000000UL
+#define RAM_SIZE (8UL << 20)
+#define LEN      256
+#define RING     8
+
+static struct MemHeader mh;
+static struct dma_mem_ctx ctx;
+static struct dma_pool *pool;
+
+/* Exactly one report since the last call, containing @what. */
+static void expect_report(const char *what)
+{
+	if (host_kprintf_count != 1 || strstr(host_kprintf_last, what) == NULL)
+	{
+		fprintf(stderr, "expected one \"%s\" report, got %lu: %s\n", what, host_kprintf_count,
+				host_kprintf_last);
+		exit(1);
+	}
+	host_kprintf_reset();
+}
+
+static void expect_quiet(void)
+{
+	if (host_kprintf_count != 0)
+	{
+		fprintf(stderr, "unexpected report: %s", host_kprintf_last);
+		exit(1);
+	}
+}
+
+/* map, then the caller's cache maintenance on map->dma, more than once, as a
+ * driver reusing a mapped RX buffer does. */
+static void test_map_and_sync(APTR buf, BOOL bounced)
+{
+	struct dma_map map;
+
+	HOST_CHECK(dma_map(pool, &map, buf, LEN, DMA_FROM_DEVICE));
+	HOST_CHECK((map.slot != NULL) == bounced);
+	dma_sync_for_device(pool, map.dma, LEN, DMA_FROM_DEVICE);
+	dma_sync_for_cpu(pool, map.dma, LEN, DMA_FROM_DEVICE);
+	dma_sync_for_cpu(pool, map.dma, LEN, DMA_FROM_DEVICE);
+	dma_sync_for_device(pool, map.dma, 64, DMA_FROM_DEVICE);
+	dma_sync_for_cpu(pool, map.dma, 64, DMA_FROM_DEVICE);
+	dma_sync_for_device(pool, map.dma, LEN, DMA_FROM_DEVICE);
+	dma_sync_for_cpu(pool, (UBYTE *)map.dma + 128, 64, DMA_FROM_DEVICE);
+	dma_unmap(pool, &map);
+
+	/* Sync for the CPU, then unmap: the unmap is not a second take-back. */
+	HOST_CHECK(dma_map(pool, &map, buf, 100, DMA_BIDIRECTIONAL));
+	dma_sync_for_device(pool, map.dma, 100, DMA_BIDIRECTIONAL);
+	dma_sync_for_cpu(pool, map.dma, 100, DMA_BIDIRECTIONAL);
+	dma_unmap(pool, &map);
+	expect_quiet();
+}
+
+static void test_batch(UBYTE *ring)
+{
+	struct dma_map map[RING];
+	struct dma_sync_range r[RING];
+
+	/* The take-back reuses the array the hand-over coalesced (one span here). */
+	for (ULONG i = 0; i < RING; i++)
+		HOST_CHECK(dma_map(pool, &map[i], ring + i * LEN, LEN, DMA_FROM_DEVICE) && !map[i].slot);
+	for (int pass = 0; pass < 3; pass++)
+	{
+		for (ULONG i = 0; i < RING; i++)
+			r[i] = (struct dma_sync_range){ map[i].dma, LEN };
+		dma_sync_for_device_batch(pool, r, RING, DMA_FROM_DEVICE);
+		HOST_CHECK(r[0].addr == ring && r[0].len == RING * LEN && r[1].len == 0);
+		dma_sync_for_cpu_batch(pool, r, RING, DMA_FROM_DEVICE);
+	}
+	for (ULONG i = 0; i < RING; i++)
+		dma_unmap(pool, &map[i]);
+	expect_quiet();
+
+	/* Without dma_map(), the sync calls alone hand over and take back, including
+	 * buffers that do not end on a line and every other one of the ring. */
+	for (ULONG i = 0; i < RING; i++)
+		r[i] = (struct dma_sync_range){ ring + i * LEN, LEN - 8 * (i & 1) };
+	dma_sync_for_device_batch(pool, r, RING, DMA_TO_DEVICE);
+	dma_sync_for_cpu_batch(pool, r, RING, DMA_TO_DEVICE);
+	for (ULONG i = 0; i < RING / 2; i++)
+		r[i] = (struct dma_sync_range){ ring + 2 * i * LEN, LEN };
+	dma_sync_for_device_batch(pool, r, RING / 2, DMA_FROM_DEVICE);
+	dma_sync_for_cpu_batch(pool, r, RING / 2, DMA_FROM_DEVICE);
+	expect_quiet();
+
+	/* A range holding no device-owned buffer is still a stray take-back. */
+	dma_sync_for_cpu_batch(pool, r, 1, DMA_FROM_DEVICE);
+	expect_report("not a device-owned buffer");
+}
+
+static void test_misuse(UBYTE *buf)
+{
+	struct dma_map a, b;
+
+	HOST_CHECK(dma_map(pool, &a, buf, LEN, DMA_FROM_DEVICE));
+	HOST_CHECK(dma_map(pool, &b, buf + 64, 64, DMA_FROM_DEVICE));
+	expect_report("already owned by the device");
+	dma_unmap(pool, &b);
+	dma_unmap(pool, &a);
+	expect_quiet();
+
+	dma_sync_for_device(pool, buf, LEN, DMA_FROM_DEVICE);
+	dma_sync_for_device(pool, buf, LEN, DMA_FROM_DEVICE);
+	expect_report("already owned by the device");
+	dma_sync_for_cpu(pool, buf, LEN, DMA_FROM_DEVICE);
+	dma_sync_for_cpu(pool, buf, LEN, DMA_FROM_DEVICE);
+	expect_quiet(); /* one take-back per recorded hand-over */
+	dma_sync_for_cpu(pool, buf, LEN, DMA_FROM_DEVICE);
+	expect_report("not a device-owned buffer");
+
+	/* A sub-range take-back anywhere in the buffer returns it. */
+	dma_sync_for_device(pool, buf, LEN, DMA_FROM_DEVICE);
+	dma_sync_for_cpu(pool, buf + 64, 64, DMA_FROM_DEVICE);
+	expect_quiet();
+	dma_sync_for_cpu(pool, buf + 64, 64, DMA_FROM_DEVICE);
+	expect_report("not a device-owned buffer");
+
+	/* The CPU may write a mapped DMA_TO_DEVICE buffer only while it owns it. */
+	HOST_CHECK(dma_map(pool, &a, buf, LEN, DMA_TO_DEVICE));
+	buf[3] ^= 1;
+	dma_sync_for_cpu(pool, a.dma, LEN, DMA_TO_DEVICE);
+	expect_report("CPU wrote");
+	buf[3] ^= 1;
+	dma_sync_for_device(pool, a.dma, LEN, DMA_TO_DEVICE);
+	dma_unmap(pool, &a);
+	expect_quiet();
+
+	/* Device-written sync of a range with partial lines; device-read is fine. */
+	dma_sync_for_device(pool, buf + 8, 100, DMA_FROM_DEVICE);
+	expect_report("does not start and end on a cache line");
+	dma_sync_for_cpu(pool, buf + 8, 100, DMA_FROM_DEVICE);
+	dma_sync_for_device(pool, buf + 8, 100, DMA_TO_DEVICE);
+	dma_sync_for_cpu(pool, buf + 8, 100, DMA_TO_DEVICE);
+	expect_quiet();
+
+	/* Neighbours in one cache line, either handed over first, are named when one
+	 * of them is device-written; two device-read ones may share. */
+	dma_sync_for_device(pool, buf, 96, DMA_TO_DEVICE);
+	dma_sync_for_device(pool, buf + 96, 96, DMA_FROM_DEVICE);
+	expect_report("shares a cache line with device-owned 38");
+	dma_sync_for_cpu(pool, buf, 96, DMA_TO_DEVICE);
+	dma_sync_for_device(pool, buf, 96, DMA_TO_DEVICE);
+	expect_report("shares a cache line");
+	dma_sync_for_cpu(pool, buf + 96, 96, DMA_FROM_DEVICE);
+	dma_sync_for_device(pool, buf + 96, 96, DMA_TO_DEVICE);
+	dma_sync_for_cpu(pool, buf + 96, 96, DMA_TO_DEVICE);
+	dma_sync_for_cpu(pool, buf, 96, DMA_TO_DEVICE);
+	expect_quiet();
+}
+
+static void test_free_while_mapped(void)
+{
+	struct dma_map map;
+	APTR p = dma_alloc(pool, DMA_ALIGN_MIN, LEN);
+
+	HOST_CHECK(dma_map(pool, &map, p, LEN, DMA_FROM_DEVICE) && !map.slot);
+	dma_sync_for_cpu(pool, map.dma, LEN, DMA_FROM_DEVICE);
+	dma_free(pool, p);
+	expect_report("is still mapped");
+	dma_unmap(pool, &map);
+	expect_quiet();
+}
+
+int main(void)
+{
+	static UBYTE host_buf[LEN] __attribute__((aligned(64)));
+
+	host_ram(RAM_BASE, RAM_SIZE);
+	pool = host_dma_pool(&mh, &ctx, RAM_BASE, RAM_SIZE);
+	HOST_CHECK(dma_pool_bounce_init(pool, 2, LEN));
+
+	UBYTE *buf = dma_alloc(pool, DMA_ALIGN_MIN, LEN);
+	UBYTE *ring = dma_alloc(pool, DMA_ALIGN_MIN, RING * LEN);
+	HOST_CHECK(buf != NULL && ring != NULL);
+	host_kprintf_reset();
+
+	test_map_and_sync(buf, FALSE);
+	test_map_and_sync(host_buf, TRUE);
+	test_batch(ring);
+	test_misuse(buf);
+	test_free_while_mapped();
+
+	dma_free(pool, ring);
+	dma_free(pool, buf);
+	expect_quiet();
+	dma_pool_delete(pool);
+	dma_mem_exit(&ctx);
+
+	printf("test_dma_track: ok\n");
+	return 0;
+}
@@ -0,0 +1,169 @@
+/* SPDX-License-Identifier: MPL-2.0 OR GPL-2.0+ */
+/*
+ * dma_addr_reachable() against the per-header loop it replaced, on random Emu68 RAM
+ * layouts discovered through dma_mem_init().  Every query must agree with a reference
+ * that walks the headers byte-contiguously (spans across touching headers are
+ * reachable), and anything the old loop accepted must still be accepted.  With no
+ * regions both fall back to the "above Chip RAM" heuristic.
+ */
+
+#include "host_exec.h"
+
+#include <dma_mem.h>
+#include <string.h>
+
+#define RAM_BASE    0x10000000UL
+#define RAM_SIZE    (128UL << 20)
+#define MAX_HEADERS 12
+#define LAYOUTS     300
+#define QUERIES     20000
+
+struct layout
+{
+	ULONG start[MAX_HEADERS];
+	ULONG end[MAX_HEADERS];
+	ULONG count;
+};
+
+/* The loop dma_addr_reachable() used before the lookup table: one header must hold
+ * the whole span. */
+static BOOL old_reachable(const struct layout *l, ULONG a, ULONG len)
+{
+	ULONG end = a + (len ? len : 1);
+	if (end < a)
+		return FALSE;
+	if (l->count == 0)
+		return a >= 0x00200000UL;
+
+	for (ULONG i = 0; i < l->count; i++)
+	{
+		if (a >= l->start[i] && end <= l->end[i])
+			return TRUE;
+	}
+	return FALSE;
+}
+
+/* Follow the span from header to header while they touch. */
+static BOOL merged_reachable(const struct layout *l, ULONG a, ULONG len)
+{
+	ULONG end = a + (len ? len : 1);
+	if (end < a)
+		return FALSE;
+	if (l->count == 0)
+		return a >= 0x00200000UL;
+
+	for (ULONG cur = a;;)
+	{
+		ULONG i;
+		for (i = 0; i < l->count; i++)
+		{
+			if (cur >= l->start[i] && cur < l->end[i])
+				break;
+		}
+		if (i == l->count)
+			return FALSE;
+		if (end <= l->end[i])
+			return TRUE;
+		cur = l->end[i];
+	}
+}
+
+static ULONG rnd(ULONG n)
+{
+	return n ? (ULONG)rand() % n : 0;
+}
+
+/* Random headers in RAM_BASE.., some touching, some with gaps, listed in random
+ * order, plus a chip header the window filter must ignore. */
+static void make_layout(struct layout *l, struct MemHeader *mh, struct MemHeader *chip, UBYTE *chip_ram)
+{
+	host_exec_init();
+	host_dt_memory(RAM_BASE, RAM_SIZE);
+
+	l->count = rnd(MAX_HEADERS + 1);
+	ULONG cur = RAM_BASE + (rnd(16) << 20);
+	ULONG n = 0;
+	for (; n < l->count; n++)
+	{
+		if (rnd(3) != 0)
+			cur += rnd(3 << 20) & ~(MEM_BLOCKSIZE - 1);
+		ULONG size = (rnd(8 << 20) + MEM_BLOCKSIZE) & ~(MEM_BLOCKSIZE - 1);
+		if (cur + size > RAM_BASE + RAM_SIZE)
+			break;
+		l->start[n] = cur;
+		l->end[n] = cur + size;
+		cur += size;
+	}
+	l->count = n;
+
+	for (ULONG i = 0; i + 1 < l->count; i++)
+	{
+		ULONG j = i + rnd(l->count - i);
+		ULONG s = l->start[i], e = l->end[i];
+		l->start[i] = l->start[j];
+		l->end[i] = l->end[j];
+		l->start[j] = s;
+		l->end[j] = e;
+	}
+
+	for (ULONG i = 0; i < l->count; i++)
+		host_add_header(&mh[i], l->start[i], l->end[i] - l->start[i], MEMF_FAST | MEMF_PUBLIC);
+	host_add_header(chip, (ULONG)chip_ram, 4096, MEMF_CHIP | MEMF_PUBLIC);
+}
+
+int main(void)
+{
+	static struct MemHeader mh[MAX_HEADERS];
+	static struct MemHeader chip;
+	static UBYTE chip_ram[4096] __attribute__((aligned(16)));
+	struct layout l;
+	struct dma_mem_ctx ctx;
+	ULONG checked = 0;
+
+	srand(1);
+	host_ram(RAM_BASE, RAM_SIZE);
+
+	for (int iter = 0; iter < LAYOUTS; iter++)
+	{
+		make_layout(&l, mh, &chip, chip_ram);
+		memset(&ctx, 0xa5, sizeof(ctx));
+		dma_mem_init(&ctx);
+		HOST_CHECK(ctx.count == l.count);
+		HOST_CHECK(l.count == 0 || !dma_addr_reachable(&ctx, chip_ram, 16));
+
+		for (int q = 0; q < QUERIES; q++)
+		{
+			ULONG a = RAM_BASE - (8UL << 20) + rnd(RAM_SIZE + (16UL << 20));
+			if (l.count != 0 && rnd(4) == 0)
+			{
+				/* Aim at a header edge, where the interesting cases are. */
+				ULONG r = rnd(l.count);
+				a = (rnd(2) ? l.start[r] : l.end[r]) + rnd(128) - 64;
+			}
+			ULONG len = rnd(2) ? rnd(4096) : rnd(4UL << 20);
+
+			BOOL got = dma_addr_reachable(&ctx, (APTR)a, len);
+			BOOL want = merged_reachable(&l, a, len);
+			BOOL old = old_reachable(&l, a, len);
+			if (got != want || (old && !got))
+			{
+				for (ULONG i = 0; i < l.count; i++)
+					fprintf(stderr, "header %08lx..%08lx\n", l.start[i], l.end[i]);
+				fprintf(stderr, "addr %08lx len %lu: new %d, merged %d, old %d\n", a, len, got, want, old);
+				return 1;
+			}
+			checked++;
+		}
+		dma_mem_exit(&ctx);
+	}
+
+	/* No device tree: the historical "above Chip RAM" heuristic; no context: never. */
+	host_exec_init();
+	dma_mem_init(&ctx);
+	HOST_CHECK(dma_addr_reachable(&ctx, (APTR)RAM_BASE, 16));
+	HOST_CHECK(!dma_addr_reachable(&ctx, (APTR)0x1000UL, 16));
+	HOST_CHECK(!dma_addr_reachable(NULL, (APTR)RAM_BASE, 16));
+
+	printf("test_reachable: %lu queries over %d layouts ok\n", checked, LAYOUTS);
+	return 0;
+}
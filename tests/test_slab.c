@@ -0,0 +1,230 @@
+/* SPDX-License-Identifier: MPL-2.0 OR GPL-2.0+ */
+/*
+ * slab_shrink(): random alloc/free mixes over many slabs, with objects parked on
+ * the free list, the scrubbed clean list, the irq pending list and the untouched
+ * bump region.  Each shrink must release exactly the slabs holding no live object
+ * (counted independently from the slab list), keep every live object intact, and
+ * leave a cache that still hands out only free objects.  CPU-only and DMA slabs,
+ * with and without colouring, and constructor caches with the free-list link in
+ * the padding or in the side array: those keep the object size and never touch a
+ * free object's bytes.
+ */
+
+#include "host_exec.h"
+
+#include <slab.h>
+#include <bits.h>
+#include <string.h>
+
+#define RAM_BASE 0x48000000UL
+#define RAM_SIZE (64UL << 20)
+#define OBJS     6000
+#define ROUNDS   40
+
+struct obj
+{
+	UBYTE *ptr;
+	UBYTE fill;
+};
+
+static struct obj live[OBJS];
+static ULONG obj_bytes; /* size asked for; cache->obj_size may be larger */
+static ULONG constructed;
+
+static BOOL ctor(APTR obj, APTR user)
+{
+	(void)user;
+	memset(obj, 0x5a, obj_bytes);
+	constructed++;
+	return TRUE;
+}
+
+static void dtor(APTR obj, APTR user)
+{
+	(void)obj;
+	(void)user;
+	constructed--;
+}
+
+static ULONG slab_count(struct slab_cache *cache)
+{
+	ULONG n = 0;
+	for (struct slab_node *node = cache->slabs; node; node = node->next)
+		n++;
+	return n;
+}
+
+/* Slabs none of live[] points into. */
+static ULONG empty_slabs(struct slab_cache *cache)
+{
+	ULONG span = cache->obj_size * cache->slab_capacity;
+	ULONG empty = 0;
+
+	for (struct slab_node *node = cache->slabs; node; node = node->next)
+	{
+		ULONG i;
+		for (i = 0; i < OBJS; i++)
+		{
+			if (live[i].ptr && (ULONG)live[i].ptr - (ULONG)node->objs < span)
+				break;
+		}
+		if (i == OBJS)
+			empty++;
+	}
+	return empty;
+}
+
+static void check_live(struct slab_cache *cache)
+{
+	for (ULONG i = 0; i < OBJS; i++)
+	{
+		for (ULONG b = 0; live[i].ptr && b < obj_bytes; b++)
+			HOST_CHECK(live[i].ptr[b] == live[i].fill);
+	}
+}
+
+static void put(struct slab_cache *cache, struct obj *o, ULONG how)
+{
+	if (how % 5 == 0)
+		slab_free_irq(cache, o->ptr);
+	else
+		slab_free(cache, o->ptr);
+	o->ptr = NULL;
+}
+
+static void get(struct slab_cache *cache, struct obj *o, ULONG i)
+{
+	o->ptr = slab_alloc(cache);
+	HOST_CHECK(o->ptr != NULL);
+
+	/* Constructed objects come back as whoever freed them left them: one fill. */
+	for (ULONG b = 1; cache->ctor && b < obj_bytes; b++)
+		HOST_CHECK(o->ptr[b] == o->ptr[0]);
+
+	o->fill = (UBYTE)(i * 7 + 1);
+	memset(o->ptr, o->fill, obj_bytes);
+}
+
+static void run(struct dma_pool *dma_pool, ULONG obj_size, ULONG obj_align, ULONG capacity,
+				BOOL with_ctor)
+{
+	struct slab_cache cache;
+	APTR meta_pool = &cache; /* any handle: the host pool calls ignore it */
+	ULONG released = 0;
+
+	obj_bytes = obj_size;
+	if (with_ctor)
+		slab_cache_init_ctor(&cache, meta_pool, dma_pool, obj_size, obj_align, capacity, ctor,
+							 dtor, NULL);
+	else
+		slab_cache_init(&cache, meta_pool, dma_pool, obj_size, obj_align, capacity);
+	memset(live, 0, sizeof(live));
+
+	for (ULONG round = 0; round < ROUNDS; round++)
+	{
+		/* Fill most slots, then empty a few whole slabs and free a random scatter
+		 * (slabs stay partly used). */
+		for (ULONG i = 0; i < OBJS; i++)
+		{
+			if (!live[i].ptr && (ULONG)rand() % 4 != 0)
+				get(&cache, &live[i], i + round);
+		}
+		ULONG span = cache.obj_size * cache.slab_capacity;
+		for (struct slab_node *node = cache.slabs; node; node = node->next)
+		{
+			if ((ULONG)rand() % 4 != 0)
+				continue;
+			for (ULONG i = 0; i < OBJS; i++)
+			{
+				if (live[i].ptr && (ULONG)live[i].ptr - (ULONG)node->objs < span)
+					put(&cache, &live[i], i);
+			}
+		}
+		for (ULONG i = 0; i < OBJS; i++)
+		{
+			if (live[i].ptr && (ULONG)rand() % 3 == 0)
+				put(&cache, &live[i], i);
+		}
+		if (round % 3 == 0)
+			slab_scrub(&cache, (ULONG)rand() % 500);
+
+		ULONG before = slab_count(&cache);
+		ULONG want = empty_slabs(&cache);
+		HOST_CHECK(slab_shrink(&cache) == want);
+		released += want;
+		HOST_CHECK(slab_count(&cache) == before - want);
+		HOST_CHECK(empty_slabs(&cache) == 0);
+		HOST_CHECK(slab_shrink(&cache) == 0);
+		check_live(&cache);
+	}
+
+	HOST_CHECK(released >= ROUNDS / 2);
+
+	/* What is left on the lists is free: handing it all out overlaps nothing live. */
+	for (ULONG i = 0; i < OBJS; i++)
+	{
+		if (!live[i].ptr)
+			get(&cache, &live[i], i);
+	}
+	check_live(&cache);
+
+	for (ULONG i = 0; i < OBJS; i++)
+		put(&cache, &live[i], i);
+	HOST_CHECK(slab_shrink(&cache) > 0 && cache.slabs == NULL);
+	slab_cache_destroy(&cache);
+	HOST_CHECK(constructed == 0);
+}
+
+/* Where a constructor cache keeps its links, and what that costs per object. */
+static void test_ctor_layout(struct dma_pool *pool)
+{
+	struct slab_cache cache;
+
+	slab_cache_init_ctor(&cache, &cache, pool, 64, 0, 0, ctor, dtor, NULL);
+	HOST_CHECK(cache.obj_size == 64 && cache.link_off == SLAB_LINK_SIDE);
+	slab_cache_destroy(&cache);
+
+	slab_cache_init_ctor(&cache, &cache, pool, 100, 0, 0, ctor, dtor, NULL);
+	HOST_CHECK(cache.obj_size == 128 && cache.link_off == ALIGN_UP(100, sizeof(APTR)));
+	slab_cache_destroy(&cache);
+
+	/* Pointer-aligned: one more word beats a binary search per alloc/free. */
+	slab_cache_init_ctor(&cache, &cache, NULL, 3 * sizeof(APTR), 0, 0, ctor, dtor, NULL);
+	HOST_CHECK(cache.obj_size == 4 * sizeof(APTR) && cache.link_off == 3 * sizeof(APTR));
+	slab_cache_destroy(&cache);
+
+	slab_cache_init_ctor(&cache, &cache, NULL, 10, 0, 0, ctor, dtor, NULL);
+	HOST_CHECK(cache.obj_size == ALIGN_UP(10, sizeof(APTR)) + sizeof(APTR));
+	HOST_CHECK(cache.link_off == ALIGN_UP(10, sizeof(APTR)));
+	slab_cache_destroy(&cache);
+
+	slab_cache_init_ctor(&cache, &cache, NULL, 32, 16, 0, ctor, dtor, NULL);
+	HOST_CHECK(cache.obj_size == 32 && cache.link_off == SLAB_LINK_SIDE);
+	slab_cache_destroy(&cache);
+}
+
+int main(void)
+{
+	static struct MemHeader mh;
+	struct dma_mem_ctx ctx;
+
+	srand(9);
+	host_ram(RAM_BASE, RAM_SIZE);
+	struct dma_pool *pool = host_dma_pool(&mh, &ctx, RAM_BASE, RAM_SIZE);
+
+	test_ctor_layout(pool);
+	run(NULL, 48, 0, 16, FALSE);
+	run(NULL, 24, 0, 7, FALSE);
+	run(pool, 64, 0, 32, FALSE);  /* DMA, coloured */
+	run(pool, 200, 0, 0, FALSE);  /* DMA, default slab size */
+	run(pool, 64, 0, 32, TRUE);	  /* ctor, side links */
+	run(NULL, 20, 16, 9, TRUE);	  /* ctor, link in the padding */
+	run(NULL, 24, 0, 5, TRUE);	  /* ctor, side links, tiny slabs */
+
+	dma_pool_delete(pool);
+	HOST_CHECK(mh.mh_Free == RAM_SIZE);
+	dma_mem_exit(&ctx);
+
+	printf("test_slab: ok\n");
+	return 0;
+}
@@ -0,0 +1,142 @@
+/* SPDX-License-Identifier: MPL-2.0 OR GPL-2.0+ */
+/*
+ * dma_sync_coalesce(): ranges are widened to whole DMA_ALIGN_MIN lines, empty ones
+ * dropped, and the rest sorted and merged when they touch or overlap.  Hand-picked
+ * cases, then random batches checked against a per-line bitmap, then the _batch
+ * sync calls issuing one cache call per merged span.
+ */
+
+#include "host_exec.h"
+
+#include <dma_mem.h>
+#include <string.h>
+
+#define BASE  0x30000000UL
+#define LINES 256
+#define BATCH 64
+
+static void check_ranges(const struct dma_sync_range *r, ULONG n, const ULONG *want, ULONG want_n)
+{
+	HOST_CHECK(n == want_n);
+	for (ULONG i = 0; i < n; i++)
+	{
+		HOST_CHECK((ULONG)r[i].addr == want[2 * i]);
+		HOST_CHECK(r[i].len == want[2 * i + 1]);
+	}
+}
+
+static void test_cases(void)
+{
+	struct dma_sync_range r[8];
+
+	/* Empty input and empty ranges. */
+	HOST_CHECK(dma_sync_coalesce(r, 0) == 0);
+	r[0] = (struct dma_sync_range){ (APTR)(BASE + 5), 0 };
+	r[1] = (struct dma_sync_range){ (APTR)BASE, 0 };
+	HOST_CHECK(dma_sync_coalesce(r, 2) == 0);
+
+	/* Widening: a few bytes straddling a line boundary become two lines. */
+	r[0] = (struct dma_sync_range){ (APTR)(BASE + DMA_ALIGN_MIN - 2), 4 };
+	const ULONG widened[] = { BASE, 2 * DMA_ALIGN_MIN };
+	check_ranges(r, dma_sync_coalesce(r, 1), widened, 1);
+
+	/* Sorting: reversed disjoint ranges come out in address order. */
+	r[0] = (struct dma_sync_range){ (APTR)(BASE + 8 * DMA_ALIGN_MIN), 1 };
+	r[1] = (struct dma_sync_range){ (APTR)(BASE + 4 * DMA_ALIGN_MIN + 3), 10 };
+	r[2] = (struct dma_sync_range){ (APTR)BASE, DMA_ALIGN_MIN };
+	const ULONG sorted[] = { BASE, DMA_ALIGN_MIN, BASE + 4 * DMA_ALIGN_MIN, DMA_ALIGN_MIN,
+							 BASE + 8 * DMA_ALIGN_MIN, DMA_ALIGN_MIN };
+	check_ranges(r, dma_sync_coalesce(r, 3), sorted, 3);
+
+	/* Merging: touching after widening, overlapping, and contained ranges, with an
+	 * empty one in between. */
+	r[0] = (struct dma_sync_range){ (APTR)(BASE + DMA_ALIGN_MIN + 1), 2 };
+	r[1] = (struct dma_sync_range){ (APTR)BASE, 10 };
+	r[2] = (struct dma_sync_range){ (APTR)(BASE + 2 * DMA_ALIGN_MIN), 3 * DMA_ALIGN_MIN };
+	r[3] = (struct dma_sync_range){ (APTR)(BASE + 9 * DMA_ALIGN_MIN), 0 };
+	r[4] = (struct dma_sync_range){ (APTR)(BASE + 3 * DMA_ALIGN_MIN), 5 };
+	r[5] = (struct dma_sync_range){ (APTR)(BASE + 10 * DMA_ALIGN_MIN), DMA_ALIGN_MIN };
+	const ULONG merged[] = { BASE, 5 * DMA_ALIGN_MIN, BASE + 10 * DMA_ALIGN_MIN, DMA_ALIGN_MIN };
+	check_ranges(r, dma_sync_coalesce(r, 6), merged, 2);
+}
+
+/* Random batches: the output covers exactly the lines the input touched, as sorted,
+ * line-aligned spans with a gap between each pair. */
+static void test_random(void)
+{
+	struct dma_sync_range r[BATCH];
+	UBYTE want[LINES], got[LINES];
+
+	for (int iter = 0; iter < 20000; iter++)
+	{
+		ULONG count = (ULONG)rand() % (BATCH + 1);
+		memset(want, 0, sizeof(want));
+
+		for (ULONG i = 0; i < count; i++)
+		{
+			ULONG off = (ULONG)rand() % (LINES * DMA_ALIGN_MIN / 2);
+			ULONG len = (ULONG)rand() % 4 == 0 ? 0 : (ULONG)rand() % (4 * DMA_ALIGN_MIN);
+			if (off + len > LINES * DMA_ALIGN_MIN)
+				len = LINES * DMA_ALIGN_MIN - off;
+			r[i].addr = (APTR)(BASE + off);
+			r[i].len = len;
+			for (ULONG l = off / DMA_ALIGN_MIN; len && l <= (off + len - 1) / DMA_ALIGN_MIN; l++)
+				want[l] = 1;
+		}
+
+		ULONG n = dma_sync_coalesce(r, count);
+		memset(got, 0, sizeof(got));
+		for (ULONG i = 0; i < n; i++)
+		{
+			ULONG start = (ULONG)r[i].addr - BASE;
+			HOST_CHECK((start | r[i].len) % DMA_ALIGN_MIN == 0 && r[i].len != 0);
+			if (i > 0)
+				HOST_CHECK((ULONG)r[i].addr > (ULONG)r[i - 1].addr + r[i - 1].len);
+			for (ULONG l = start / DMA_ALIGN_MIN; l < (start + r[i].len) / DMA_ALIGN_MIN; l++)
+				got[l] = 1;
+		}
+		HOST_CHECK(memcmp(want, got, sizeof(want)) == 0);
+
+		/* The tail is emptied: coalescing the whole array again changes nothing. */
+		for (ULONG i = n; i < count; i++)
+			HOST_CHECK(r[i].len == 0);
+		HOST_CHECK(dma_sync_coalesce(r, count) == n);
+	}
+}
+
+/* One cache call per merged span; taking a TO_DEVICE batch back issues none. */
+static void test_batch(void)
+{
+	struct dma_sync_range r[4];
+
+	host_exec_init();
+	for (ULONG i = 0; i < 4; i++)
+	{
+		r[i].addr = (APTR)(BASE + (3 - i) * 1536);
+		r[i].len = 1536;
+	}
+	dma_sync_for_device_batch(NULL, r, 4, DMA_FROM_DEVICE);
+	HOST_CHECK(host_cache_pre_calls == 1);
+
+	for (ULONG i = 0; i < 4; i++)
+	{
+		r[i].addr = (APTR)(BASE + i * 4096);
+		r[i].len = 100;
+	}
+	dma_sync_for_cpu_batch(NULL, r, 4, DMA_FROM_DEVICE);
+	HOST_CHECK(host_cache_post_calls == 4);
+
+	dma_sync_for_cpu_batch(NULL, r, 4, DMA_TO_DEVICE);
+	HOST_CHECK(host_cache_post_calls == 4);
+}
+
+int main(void)
+{
+	srand(5);
+	test_cases();
+	test_random();
+	test_batch();
+
+	printf("test_sync_coalesce: ok\n");
+	return 0;
+}